@@ -1,8 +1,229 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <unistd.h>
 #include "var_table.h"
 
 using namespace std;
 
+/**
+ * Write a table as Arrow, as a stream and as a file, and read both back
+ */
+static void arrowRoundTrip()
+{
+    VarTable<const char*, double, int, bool, uint8_t> vt({ "Name", "Weight", "Age", "Adult", "Grade" });
+    vt.addRow("HanMei", 160.2, 16, false, 10);
+    vt.addRow("Jim Green", 175.3, 17, false, 11);
+    vt.addRow(nullptr, 0.5, 0, false, 0);
+    vt.addRow("Yeqian", 100.3, 40, true, 255);
+
+    // Two rows per record batch, so there's more than one
+    ostringstream stream;
+    vt.exportArrowIPC(stream, 2);
+
+    // The file format is the stream between magic numbers (the reader doesn't need the footer)
+    string file = string("ARROW1\0\0", 8) + stream.str() + "ARROW1";
+
+    for (auto& bytes : { stream.str(), file })
+    {
+        {
+            ofstream out("var_table_example.arrow", ios::binary);
+            out << bytes;
+        }
+
+        VarTableArrowReader reader;
+        assert(reader.open("var_table_example.arrow") && reader.rows() == 4);
+
+        // Numbers are read in place, text is copied (a null C string was written as "")
+        auto ages = reader.values<int32_t>(1, 2);
+        assert(ages && ages[1] == 40);
+
+        VarTable<string, double, int, bool, int> back({ "Name", "Weight", "Age", "Adult", "Grade" });
+        assert(reader.readInto(back));
+        assert(back.size() == 4 && back.column<0>()[2] == "" && back.column<0>()[3] == "Yeqian");
+        assert(back.sum<1>() == vt.sum<1>() && back.sum<2>() == vt.sum<2>() && back.max<4>() == 255);
+        assert(back.countIf<3>([](bool adult) { return adult; }) == 1);
+    }
+
+    unlink("var_table_example.arrow");
+    cout << "\nArrow round trip (stream and file): OK" << endl;
+}
+
+/**
+ * Stream a table through a pipe a few bytes at a time, as an event loop would
+ */
+static string writeThroughPipe(VarTable<int, string>& vt, VarTableCursor& cursor, int fds[2])
+{
+    string out;
+    char buffer[100];
+    ssize_t n;
+
+    while (vt.writeTo(fds[1], cursor) == VarTableWriteStatus::AGAIN)
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+            out.append(buffer, n);
+
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        out.append(buffer, n);
+
+    return out;
+}
+
+/**
+ * Write a table to a non-blocking descriptor, resuming each time it would block
+ */
+static void resumableWrite()
+{
+    VarTable<int, string> vt({ "Id", "Name" });
+    for (int i = 0; i < 5000; i++)
+        vt.addRow(i, "host" + to_string(i));
+
+    atomic<int> requests(1);
+    vt.bindRow(requests, string("requests"));
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    // The pipe fills up many times over, and each write carries on where the last stopped
+    VarTableCursor cursor;
+    string written = writeThroughPipe(vt, cursor, fds);
+
+    ostringstream printed;
+    vt.print(printed);
+    assert(written == printed.str());
+
+    // A new stream shows the bound row's current value
+    requests = 999;
+    VarTableCursor again;
+    assert(writeThroughPipe(vt, again, fds).find(" 999 | requests") != string::npos);
+
+    // A change part way through a stream is reported instead of tearing it
+    VarTableCursor torn;
+    assert(vt.writeTo(fds[1], torn) == VarTableWriteStatus::AGAIN);
+    vt.addRow(5000, "late");
+    assert(vt.writeTo(fds[1], torn) == VarTableWriteStatus::CHANGED);
+
+    close(fds[0]);
+    close(fds[1]);
+    cout << "Resumable write (" << written.size() << " bytes): OK" << endl;
+}
+
+/**
+ * Let rows expire, and check a handle to an expired row can't touch the row that takes its slot
+ */
+static void expiringRows()
+{
+    using namespace std::chrono;
+
+    VarTable<string, int> vt({ "Session", "Hits" });
+    vt.enableExpiry(milliseconds(1));
+
+    auto start = steady_clock::now();
+    auto alice = vt.addRowExpiring(seconds(10), "alice", 1);
+    auto bob = vt.addRowExpiring(seconds(10), "bob", 1);
+
+    // Refreshing alice keeps her past bob's expiry
+    assert(vt.refreshRow(alice, seconds(60), "alice", 2));
+    assert(vt.expire(start + seconds(30)) == 1);
+    assert(vt.rowAlive(alice) && !vt.rowAlive(bob));
+
+    // Carol gets bob's slot, but bob's handle still knows he's gone
+    auto carol = vt.addRowExpiring(seconds(10), "carol", 1);
+    assert(carol.slot == bob.slot && !vt.rowAlive(bob) && vt.rowAlive(carol));
+    assert(!vt.refreshRow(bob, seconds(60), "bob", 5));
+    assert(vt.size() == 2 && vt.sum<1>() == 3);
+
+    cout << "Expiring rows: OK" << endl;
+}
+
+/**
+ * Export a growing table a few rows at a time, carrying on across a restart
+ */
+static void appendAcrossRestart()
+{
+    const char* path = "var_table_example.csv";
+    unlink(path);
+    unlink("var_table_example.csv.state");
+
+    VarTable<string, int> vt({ "Host", "Load" });
+    vt.addRow("web1", 3);
+    vt.addRow("web2", 5);
+
+    {
+        VarTableAppendFile file;
+        assert(file.open(path, VarTableFileFormat::CSV) && vt.exportAppend(file) && file.rows() == 2);
+    }
+
+    // After a restart the table is rebuilt with a row more, and only that row is written
+    vt.addRow("db1", 9);
+    {
+        VarTableAppendFile file;
+        assert(file.open(path, VarTableFileFormat::CSV) && file.rows() == 2);
+        assert(vt.exportAppend(file) && file.rows() == 3);
+    }
+
+    ifstream in(path);
+    stringstream contents;
+    contents << in.rdbuf();
+    assert(contents.str() == "Host,Load\nweb1,3\nweb2,5\ndb1,9\n");
+
+    // Without its state file the data isn't thrown away
+    unlink("var_table_example.csv.state");
+    {
+        VarTableAppendFile file;
+        assert(!file.open(path, VarTableFileFormat::CSV));
+    }
+
+    unlink(path);
+    cout << "Append across a restart: OK" << endl;
+}
+
+/**
+ * Sort a table bigger than the memory allowed, spilling runs to disk, and one that fits without spilling
+ */
+static void externalSort()
+{
+    VarTable<double, int> vt({ "Latency", "Request" });
+    for (int i = 0; i < 200000; i++)
+        vt.addRow(i % 50 == 0 ? NAN : (i * 7919) % 100003 / 10.0, i);
+
+    size_t seen = 0, nans = 0;
+    double last = -INFINITY;
+    auto check = [&](const decltype(vt)::DataTuple& row) {
+        double latency = get<0>(row);
+        seen++;
+
+        // NaN comes after every number
+        if (std::isnan(latency))
+            nans++;
+        else
+            assert(nans == 0 && latency >= last);
+
+        last = std::isnan(latency) ? last : latency;
+    };
+
+    // 64KB holds a fraction of the keys, so they're sorted in runs, spilled and merged
+    assert(vt.sortExternal<0>("/tmp", 64 << 10, check));
+    assert(seen == 200000 && nans == 4000);
+
+    // With room for everything nothing is spilled: the directory isn't even needed
+    VarTable<double, int> small({ "Latency", "Request" });
+    for (int i = 0; i < 1000; i++)
+        small.addRow((i * 7919) % 1009, i);
+
+    seen = nans = 0;
+    last = -INFINITY;
+    assert(small.sortExternal<0>("/nonexistent", 1 << 20, check) && seen == 1000);
+
+    cout << "External sort: OK" << endl;
+}
+
 int main()
 {
     VarTable<const char*, double, int, const char*> vt({ "Name", "Weight", "Age", "Brother" }, 10);
@@ -22,4 +243,10 @@ int main()
     cout << "\nFULL Style:" << endl;
     vt.setPrintStyle(PrintStyle::FULL);
     vt.print(std::cout);
+
+    arrowRoundTrip();
+    resumableWrite();
+    expiringRows();
+    appendAcrossRestart();
+    externalSort();
 }
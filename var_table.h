@@ -2,13 +2,44 @@
 #define VAR_TABLE_H_
 
 #include <iostream>
+#include <sstream>
 #include <iomanip>
 #include <ios>
 #include <vector>
+#include <string>
+#include <memory>
 #include <tuple>
+#include <unordered_set>
+#include <unordered_map>
 #include <type_traits>
+#include <limits>
 #include <cassert>
+#include <chrono>
+#include <cerrno>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <streambuf>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <cstddef>
+#include <new>
+#include <scoped_allocator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /**
  * Used to specify the column format
@@ -43,436 +74,8118 @@ enum class AlignmentStyle
 };
 
 /**
- * A class for printing a table on Shell.
- *
- * Requries C++11 (and nothing more)
- *
- * You can use the header file below:
- *
- * VarTable<std::string, double, int, std::string> vt({"Name", "Weight", "Age", "Brother"});
- * vt.addRow("Fred", 193.4, 35, "Sam");
- * vt.print(std::cout);
+ * Colors for conditional formatting (see VarTable::addColorRule)
  */
-template <class... Ts>
-class VarTable
+enum class VarTableColor
 {
-public:
-    /// The type stored for each row
-    typedef std::tuple<Ts...> DataTuple;
-
-    /**
-     * Construct the table with headers
-     *
-     * @param headers The names of the columns
-     * @param static_column_size The size of columns that can't be found automatically
-     */
-    VarTable(std::vector<std::string> headers,
-        unsigned int static_column_size = 0,
-        unsigned int cell_padding = 1)
-        : _headers(headers),
-        _num_columns(std::tuple_size<DataTuple>::value),
-        _static_column_size(static_column_size),
-        _cell_padding(cell_padding),
-        _print_style(PrintStyle::BASIC)
-    {
-        assert(headers.size() == _num_columns);
-    }
+    RED,
+    GREEN,
+    YELLOW,
+    BLUE,
+    MAGENTA,
+    CYAN,
+    BOLD
+};
 
+/**
+ * Colors the cells of a numeric column whose value is in a range
+ *
+ * vt.addColorRule(2, VarTableColorRule::above(250.0, VarTableColor::RED));
+ */
+struct VarTableColorRule
+{
     /**
-     * Add a row of data
+     * Color values from low (inclusive) to high (exclusive)
      *
-     * @param data A Tuple of data to add
+     * @param sgr The ANSI "Select Graphic Rendition" codes to use, e.g. "1;31"
      */
-    void addRow(Ts... entries) { _data.emplace_back(std::make_tuple(entries...)); }
+    VarTableColorRule(double low, double high, const std::string& sgr) : low(low), high(high), sgr(sgr) {}
 
     /**
-     * Pretty print the table of data
+     * Color values from low (inclusive) to high (exclusive)
      */
-    template <typename StreamType>
-    void print(StreamType& stream)
+    VarTableColorRule(double low, double high, VarTableColor color) : low(low), high(high), sgr(code(color))
     {
-        size_columns();
+    }
 
-        // Start computing the total width
-        // First - we will have _num_columns + 1 "|" characters
-        unsigned int total_width = _num_columns + 1;
+    /// Color values above threshold
+    static VarTableColorRule above(double threshold, VarTableColor color)
+    {
+        return VarTableColorRule(std::nextafter(threshold, HUGE_VAL), HUGE_VAL, color);
+    }
 
-        // Now add in the size of each colum
-        for (auto& col_size : _column_sizes)
-            total_width += col_size + (2 * _cell_padding);
+    /// Color values below threshold
+    static VarTableColorRule below(double threshold, VarTableColor color)
+    {
+        return VarTableColorRule(-HUGE_VAL, threshold, color);
+    }
 
-        // Print out the top line
-        if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
-            print_plus(stream);
+    /// Color values from low to high (both inclusive)
+    static VarTableColorRule between(double low, double high, VarTableColor color)
+    {
+        return VarTableColorRule(low, std::nextafter(high, HUGE_VAL), color);
+    }
 
-        // Print out the headers
-        if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
-            stream << "|";
-        else
-            stream << " ";
-        for (unsigned int i = 0; i < _num_columns; i++)
+    /// The SGR code for a color
+    static const char* code(VarTableColor color)
+    {
+        switch (color)
         {
-            // Must find the center of the column
-            auto half = _column_sizes[i] / 2;
-            half -= _headers[i].size() / 2;
+        case VarTableColor::RED: return "31";
+        case VarTableColor::GREEN: return "32";
+        case VarTableColor::YELLOW: return "33";
+        case VarTableColor::BLUE: return "34";
+        case VarTableColor::MAGENTA: return "35";
+        case VarTableColor::CYAN: return "36";
+        default: return "1";
+        }
+    }
 
-            stream << std::string(_cell_padding, ' ') << std::setw(_column_sizes[i]) << std::left
-                << std::string(half, ' ') + _headers[i] << std::string(_cell_padding, ' ');
+    /// The smallest value colored
+    double low;
 
-            if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
-                stream << "|";
-            else
-                stream << " ";
-        }
+    /// Values from here up aren't colored
+    double high;
 
-        stream << "\n";
+    /// The ANSI SGR codes to color with
+    std::string sgr;
+};
 
-        // Print out the line below the header
-        if (_print_style != PrintStyle::EMPTY)
-            print_plus(stream);
+/**
+ * The result of writing part of a table to a file descriptor
+ */
+enum class VarTableWriteStatus
+{
+    DONE,    // The whole table has been written
+    AGAIN,   // The descriptor would block: call again when it is writable
+    CHANGED, // The table changed part way through: start again with a new cursor
+    ERROR    // The write failed: errno says why
+};
 
-        // Now print the rows of the table
-        for (auto& row : _data)
-        {
-            if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
-                stream << "|";
-            else
-                stream << " ";
+/**
+ * Where a resumable write of a table got up to (see VarTable::writeTo)
+ *
+ * Start with a default constructed cursor
+ */
+struct VarTableCursor
+{
+    VarTableCursor() : line(0), offset(0), layout(0) {}
 
-            print_each(row, stream);
-            stream << "\n";
-            if (_print_style == PrintStyle::FULL)
-                print_plus(stream);
-        }
+    /// The line being written
+    size_t line;
 
-        // Print out the line below the header
-        if (_print_style == PrintStyle::BASIC)
-            print_plus(stream);
-    }
+    /// How many bytes of that line have been written already
+    size_t offset;
 
-    /**
-     * Set how to format numbers for each column
-     *
-     * Note: this is ignored for std::string columns
-     *
-     * @column_format The format for each column: MUST be the same length as the number of columns.
-     */
-    void setColumnFormat(const std::vector<VarTableColumnFormat>& column_format)
+    /// Which layout of the table is being written
+    uint64_t layout;
+};
+
+/**
+ * A row that can expire (see VarTable::addRowExpiring)
+ *
+ * Slots are reused once their rows expire, so the generation tells the row
+ * a handle was made for from a later row in the same slot.
+ */
+struct VarTableRowHandle
+{
+    /// The slot the row is in
+    size_t slot;
+
+    /// How many rows the slot had held before this one
+    uint64_t generation;
+};
+
+/**
+ * A stream buffer that appends to a std::string
+ *
+ * Unlike std::ostringstream the string can be cleared and reused
+ * without giving up its capacity.
+ */
+class VarTableStringBuf : public std::streambuf
+{
+public:
+    VarTableStringBuf(std::string& buffer) : _buffer(buffer) {}
+
+protected:
+    int_type overflow(int_type c) override
     {
-        assert(column_format.size() == std::tuple_size<DataTuple>::value);
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+            _buffer.push_back(traits_type::to_char_type(c));
 
-        _column_format = column_format;
+        return traits_type::not_eof(c);
     }
 
-    /**
-     * Set print style
-     */
-    void setPrintStyle(const PrintStyle& print_style) { _print_style = print_style; }
+    std::streamsize xsputn(const char* s, std::streamsize n) override
+    {
+        _buffer.append(s, n);
+        return n;
+    }
+
+    /// Where the output goes
+    std::string& _buffer;
+};
+
+/**
+ * Where a table gets its memory from: a C++11 stand-in for std::pmr::memory_resource
+ *
+ * Resources are used through VarTableAllocator, and must outlive everything
+ * allocated from them.
+ */
+class VarTableMemoryResource
+{
+public:
+    virtual ~VarTableMemoryResource() {}
 
     /**
-     * Set alignment style
+     * Allocate some memory
      */
-    void setAlignmentStyle(const std::vector<AlignmentStyle>& alignment_style)
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
     {
-        assert(alignment_style.size() == std::tuple_size<DataTuple>::value);
-
-        _alignment_style = alignment_style;
+        return do_allocate(bytes, alignment);
     }
 
     /**
-     * Set how many digits of precision to show for floating point numbers
-     *
-     * Note: this is ignored for std::string columns
-     *
-     * @column_format The precision for each column: MUST be the same length as the number of columns.
+     * Give back memory from allocate(), with the same size and alignment
      */
-    void setColumnPrecision(const std::vector<int>& precision)
+    void deallocate(void* p, size_t bytes, size_t alignment = alignof(std::max_align_t))
     {
-        assert(precision.size() == std::tuple_size<DataTuple>::value);
-        _precision = precision;
+        do_deallocate(p, bytes, alignment);
     }
 
+    /**
+     * Whether memory from one resource can be given back to the other
+     */
+    bool isEqual(const VarTableMemoryResource& other) const { return this == &other || do_is_equal(other); }
+
+    /**
+     * The resource that uses new and delete (the default)
+     */
+    static VarTableMemoryResource* defaultResource();
+
 protected:
-    // Just some handy typedefs for the following two functions
-    typedef decltype(&std::right) align_type;
+    virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment) = 0;
+    virtual bool do_is_equal(const VarTableMemoryResource& /*other*/) const { return false; }
+};
 
-    // Attempts to figure out the alignment style
-    static align_type justify(AlignmentStyle align)
+/**
+ * Uses new and delete
+ */
+class VarTableNewDeleteResource : public VarTableMemoryResource
+{
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
     {
-        if (align == AlignmentStyle::LEFT)
-            return std::left;
-        else if (align == AlignmentStyle::RIGHT)
-            return std::right;
-        else
-            return std::internal;
+        assert(alignment <= alignof(std::max_align_t));
+        (void)alignment;
+
+        return ::operator new(bytes);
     }
 
-    // Attempts to figure out the correct justification for the data
-    // If it's a floating point value
-    template <typename T,
-        typename = typename std::enable_if<
-        std::is_arithmetic<typename std::remove_reference<T>::type>::value>::type>
-        static align_type justify_empty(int /*firstchoice*/)
+    void do_deallocate(void* p, size_t, size_t) override { ::operator delete(p); }
+
+    bool do_is_equal(const VarTableMemoryResource& other) const override
     {
-        return std::right;
+        return dynamic_cast<const VarTableNewDeleteResource*>(&other) != nullptr;
     }
+};
 
-    // Otherwise
-    template <typename T>
-    static align_type justify_empty(long /*secondchoice*/)
+inline VarTableMemoryResource* VarTableMemoryResource::defaultResource()
+{
+    static VarTableNewDeleteResource resource;
+    return &resource;
+}
+
+/**
+ * Hands out memory from blocks that are only given back all at once
+ *
+ * Allocating is just moving a pointer and deallocating does nothing, which
+ * suits tables that are built, printed and thrown away (e.g. one per request).
+ * Not thread safe.
+ */
+class VarTableMonotonicResource : public VarTableMemoryResource
+{
+public:
+    /**
+     * @param block_size The size of the first block: each block is twice as big as the last
+     * @param upstream Where the blocks come from
+     */
+    explicit VarTableMonotonicResource(size_t block_size = 4096,
+        VarTableMemoryResource* upstream = VarTableMemoryResource::defaultResource()) :
+        _upstream(upstream),
+        _next_size(std::max<size_t>(block_size, 64)),
+        _current(nullptr),
+        _remaining(0)
     {
-        return std::left;
     }
 
     /**
-     * These three functions print out each item in a Tuple into the table
-     *
-     * Original Idea From From https://stackoverflow.com/a/26908596
-     *
-     * BTW: This would all be a lot easier with generic lambdas
-     * there would only need to be one of this sequence and then
-     * you could pass in a generic lambda.  Unfortunately, that's C++14
+     * Start with a buffer that's already there (e.g. on the stack)
      */
-
-     /**
-      *  This ends the recursion
-      */
-    template <typename TupleType, typename StreamType>
-    void print_each(TupleType&&,
-        StreamType& /*stream*/,
-        std::integral_constant<
-        size_t,
-        std::tuple_size<typename std::remove_reference<TupleType>::type>::value>)
+    VarTableMonotonicResource(void* buffer, size_t size,
+        VarTableMemoryResource* upstream = VarTableMemoryResource::defaultResource()) :
+        _upstream(upstream),
+        _next_size(std::max<size_t>(2 * size, 64)),
+        _current(static_cast<char*>(buffer)),
+        _remaining(size)
     {
     }
 
+    ~VarTableMonotonicResource() { release(); }
+
+    VarTableMonotonicResource(const VarTableMonotonicResource&) = delete;
+    VarTableMonotonicResource& operator=(const VarTableMonotonicResource&) = delete;
+
     /**
-     * This gets called on each item
+     * Give back every block (everything allocated from the resource is gone)
      */
-    template <std::size_t I,
-        typename TupleType,
-        typename StreamType,
-        typename = typename std::enable_if<
-        I != std::tuple_size<typename std::remove_reference<TupleType>::type>::value>::type>
-        void print_each(TupleType&& t, StreamType& stream, std::integral_constant<size_t, I>)
+    void release()
     {
-        auto& val = std::get<I>(t);
+        for (auto& block : _blocks)
+            _upstream->deallocate(block.first, block.second);
 
-        // Set the precision
-        if (!_precision.empty())
+        _blocks.clear();
+        _current = nullptr;
+        _remaining = 0;
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        auto padding = (alignment - reinterpret_cast<uintptr_t>(_current) % alignment) % alignment;
+        if (!_current || padding + bytes > _remaining)
         {
-            assert(_precision.size() ==
-                std::tuple_size<typename std::remove_reference<TupleType>::type>::value);
+            // A new block, big enough for this allocation
+            while (_next_size < bytes + alignment)
+                _next_size *= 2;
 
-            stream << std::setprecision(_precision[I]);
-        }
+            _current = static_cast<char*>(_upstream->allocate(_next_size));
+            _blocks.push_back(std::make_pair(static_cast<void*>(_current), _next_size));
+            _remaining = _next_size;
+            _next_size *= 2;
 
-        // Set the format
-        if (!_column_format.empty())
-        {
-            assert(_column_format.size() ==
-                std::tuple_size<typename std::remove_reference<TupleType>::type>::value);
+            padding = (alignment - reinterpret_cast<uintptr_t>(_current) % alignment) % alignment;
+        }
 
-            if (_column_format[I] == VarTableColumnFormat::SCIENTIFIC)
-                stream << std::scientific;
+        auto p = _current + padding;
+        _current += padding + bytes;
+        _remaining -= padding + bytes;
 
-            if (_column_format[I] == VarTableColumnFormat::FIXED)
-                stream << std::fixed;
+        return p;
+    }
 
-            if (_column_format[I] == VarTableColumnFormat::PERCENT)
-                stream << std::fixed << std::setprecision(2);
-        }
+    void do_deallocate(void*, size_t, size_t) override {}
 
-        stream << std::string(_cell_padding, ' ') << std::setw(_column_sizes[I]);
-        if (!_alignment_style.empty())
-            stream << justify(_alignment_style[I]);
-        else
-            stream << justify_empty<decltype(val)>(0);
-        stream << val << std::string(_cell_padding, ' ');
+    /// Where the blocks come from
+    VarTableMemoryResource* _upstream;
 
-        if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
-            stream << "|";
-        else
-            stream << " ";
+    /// The size of the next block
+    size_t _next_size;
 
-        // Unset the format
-        if (!_column_format.empty())
-        {
-            // Because "stream << std::defaultfloat;" won't compile with old GCC or Clang
-            stream.unsetf(std::ios_base::floatfield);
-        }
+    /// The free part of the current block
+    char* _current;
+    size_t _remaining;
 
-        // Recursive call to print the next item
-        print_each(std::forward<TupleType>(t), stream, std::integral_constant<size_t, I + 1>());
-    }
+    /// The blocks, to give back
+    std::vector<std::pair<void*, size_t>> _blocks;
+};
 
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Backs big allocations with huge pages, for fewer TLB misses when scanning big tables
+ *
+ * Big allocations are mapped directly, with explicit huge pages where the
+ * system has them reserved (Linux MAP_HUGETLB) or else as ordinary memory
+ * marked for transparent huge pages.  Small allocations go upstream, so they
+ * don't each take up a whole huge page.
+ */
+class VarTableHugePageResource : public VarTableMemoryResource
+{
+public:
     /**
-     * his is what gets called first
+     * @param threshold Allocations this big or bigger are mapped
+     * @param upstream Where smaller allocations come from
      */
-    template <typename TupleType, typename StreamType>
-    void print_each(TupleType&& t, StreamType& stream)
+    explicit VarTableHugePageResource(size_t threshold = 1 << 20,
+        VarTableMemoryResource* upstream = VarTableMemoryResource::defaultResource()) :
+        _threshold(threshold),
+        _upstream(upstream)
     {
-        print_each(std::forward<TupleType>(t), stream, std::integral_constant<size_t, 0>());
     }
 
-    /**
-     * Try to find the size the column will take up
-     *
+    /// The size of a huge page
+    static size_t pageSize() { return 2 << 20; }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        if (bytes < _threshold)
+            return _upstream->allocate(bytes, alignment);
+
+        auto size = mapped_size(bytes);
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (p == MAP_FAILED)
+        {
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            madvise(p, size, MADV_HUGEPAGE);
+#endif
+        }
+
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        if (bytes < _threshold)
+            _upstream->deallocate(p, bytes, alignment);
+        else
+            munmap(p, mapped_size(bytes));
+    }
+
+    bool do_is_equal(const VarTableMemoryResource& other) const override { return this == &other; }
+
+    /**
+     * Round up to a whole number of huge pages
+     */
+    static size_t mapped_size(size_t bytes) { return (bytes + pageSize() - 1) / pageSize() * pageSize(); }
+
+    /// The smallest allocation that's mapped
+    size_t _threshold;
+
+    /// Where smaller allocations come from
+    VarTableMemoryResource* _upstream;
+};
+#endif
+
+/**
+ * An allocator that gets its memory from a VarTableMemoryResource: a C++11
+ * stand-in for std::pmr::polymorphic_allocator
+ *
+ * Like polymorphic_allocator it isn't propagated by assignment or swap, so
+ * a table's rows stay in the table's resource.
+ */
+template <class T>
+class VarTableAllocator
+{
+public:
+    typedef T value_type;
+
+    VarTableAllocator() : _resource(VarTableMemoryResource::defaultResource()) {}
+
+    VarTableAllocator(VarTableMemoryResource* resource) : _resource(resource) {}
+
+    template <class U>
+    VarTableAllocator(const VarTableAllocator<U>& other) : _resource(other.resource()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(_resource->allocate(n * sizeof(T), alignof(T))); }
+
+    void deallocate(T* p, size_t n) { _resource->deallocate(p, n * sizeof(T), alignof(T)); }
+
+    /// Copies of containers get the default resource
+    VarTableAllocator select_on_container_copy_construction() const { return VarTableAllocator(); }
+
+    /**
+     * The resource the memory comes from
+     */
+    VarTableMemoryResource* resource() const { return _resource; }
+
+protected:
+    VarTableMemoryResource* _resource;
+};
+
+template <class T, class U>
+bool operator==(const VarTableAllocator<T>& a, const VarTableAllocator<U>& b)
+{
+    return a.resource()->isEqual(*b.resource());
+}
+
+template <class T, class U>
+bool operator!=(const VarTableAllocator<T>& a, const VarTableAllocator<U>& b)
+{
+    return !(a == b);
+}
+
+/**
+ * A string whose characters come from a memory resource
+ *
+ * Use it for the string columns of a table that has a memory resource, and
+ * the strings' characters go in the table's resource too.
+ */
+typedef std::basic_string<char, std::char_traits<char>, VarTableAllocator<char>> VarTableString;
+
+/**
+ * Runs the work of a table's parallel operations (sorting, deduplicating, the column aggregates)
+ *
+ * Tables use VarTableExecutor::defaultExecutor(), a work-stealing pool with a
+ * thread per core, unless given another with setExecutor(): your own pool, or
+ * a VarTableInlineExecutor to run everything on the calling thread.  The
+ * default pool is only started the first time a table has enough work to
+ * split (a table given its own executor never starts it).  Executors must
+ * outlive the tables using them.
+ */
+class VarTableExecutor
+{
+public:
+    virtual ~VarTableExecutor() {}
+
+    /**
+     * Run a task at some point, on any thread
+     */
+    void submit(std::function<void()> task) { do_submit(std::move(task)); }
+
+    /**
+     * Call task(0) ... task(tasks - 1), possibly at the same time, and wait for them all
+     */
+    void parallelFor(unsigned int tasks, const std::function<void(unsigned int)>& task)
+    {
+        do_parallel_for(tasks, task);
+    }
+
+    /**
+     * How many tasks can usefully run at once
+     */
+    unsigned int concurrency() const { return do_concurrency(); }
+
+    /**
+     * The pool tables use unless they're given another executor
+     */
+    static VarTableExecutor* defaultExecutor();
+
+protected:
+    virtual void do_submit(std::function<void()> task) = 0;
+    virtual unsigned int do_concurrency() const = 0;
+
+    /**
+     * Run one task that is waiting to start, if there is one
+     *
+     * Lets a thread waiting in parallelFor() help instead of blocking, so
+     * parallelFor() can be called from inside a task.
+     *
+     * @return Whether a task was run
+     */
+    virtual bool do_run_queued() { return false; }
+
+    /**
+     * Submits tasks 1 and up and runs task 0 on the calling thread
+     */
+    virtual void do_parallel_for(unsigned int tasks, const std::function<void(unsigned int)>& task)
+    {
+        if (tasks == 0)
+            return;
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        unsigned int left = tasks - 1;
+
+        for (unsigned int t = 1; t < tasks; t++)
+        {
+            do_submit([&, t]() {
+                task(t);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--left == 0)
+                    finished.notify_all();
+            });
+        }
+
+        task(0);
+
+        // Once nothing is left waiting to start, the rest of the tasks are running and only need waiting for
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (left == 0)
+                    return;
+            }
+
+            if (!do_run_queued())
+                break;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return left == 0; });
+    }
+};
+
+/**
+ * Runs every task on the calling thread, in order: for tests and deterministic runs
+ */
+class VarTableInlineExecutor : public VarTableExecutor
+{
+protected:
+    void do_submit(std::function<void()> task) override { task(); }
+
+    unsigned int do_concurrency() const override { return 1; }
+
+    void do_parallel_for(unsigned int tasks, const std::function<void(unsigned int)>& task) override
+    {
+        for (unsigned int t = 0; t < tasks; t++)
+            task(t);
+    }
+};
+
+/**
+ * A work-stealing thread pool
+ *
+ * Each worker has its own queue: tasks submitted from a worker go on its own
+ * queue and it takes the newest first, while idle workers steal the oldest
+ * tasks from the others.  Tasks submitted from other threads are spread over
+ * the queues.
+ */
+class VarTableThreadPool : public VarTableExecutor
+{
+public:
+    /**
+     * @param threads How many workers to start (one per core if 0)
+     */
+    explicit VarTableThreadPool(unsigned int threads = 0)
+        : _num_queues(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+        _queues(new Queue[_num_queues]),
+        _next_queue(0),
+        _queued(0),
+        _stopping(false)
+    {
+        for (unsigned int w = 0; w < _num_queues; w++)
+            _workers.emplace_back([this, w]() { work(w); });
+    }
+
+    /**
+     * Finishes the tasks already submitted, then stops the workers
+     */
+    ~VarTableThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_all();
+
+        for (auto& worker : _workers)
+            worker.join();
+    }
+
+protected:
+    /**
+     * A worker's tasks
+     */
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void do_submit(std::function<void()> task) override
+    {
+        unsigned int q = current_pool() == this ? current_worker() :
+            _next_queue.fetch_add(1, std::memory_order_relaxed) % _num_queues;
+
+        {
+            std::lock_guard<std::mutex> lock(_queues[q].mutex);
+            _queues[q].tasks.push_back(std::move(task));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queued++;
+        }
+        _wake.notify_one();
+    }
+
+    unsigned int do_concurrency() const override { return _num_queues; }
+
+    bool do_run_queued() override { return run_one(current_pool() == this ? current_worker() : 0); }
+
+    /**
+     * Run the newest task of queue home, or else steal the oldest task of another queue
+     */
+    bool run_one(unsigned int home)
+    {
+        std::function<void()> task;
+
+        for (unsigned int i = 0; i < _num_queues && !task; i++)
+        {
+            auto& queue = _queues[(home + i) % _num_queues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (queue.tasks.empty())
+                continue;
+
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+
+        if (!task)
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queued--;
+        }
+
+        task();
+        return true;
+    }
+
+    /**
+     * A worker: runs tasks until the pool is stopped and nothing is left
+     */
+    void work(unsigned int index)
+    {
+        current_pool() = this;
+        current_worker() = index;
+
+        while (true)
+        {
+            if (run_one(index))
+                continue;
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this]() { return _stopping || _queued > 0; });
+
+            if (_stopping && _queued == 0)
+                return;
+        }
+    }
+
+    /**
+     * The pool the calling thread works for (nullptr if it isn't a worker), and which worker it is
+     */
+    static VarTableThreadPool*& current_pool()
+    {
+        static thread_local VarTableThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static unsigned int& current_worker()
+    {
+        static thread_local unsigned int worker = 0;
+        return worker;
+    }
+
+    unsigned int _num_queues;
+    std::unique_ptr<Queue[]> _queues;
+
+    /// The queue the next task from outside the pool goes on
+    std::atomic<unsigned int> _next_queue;
+
+    /// Guards _queued and _stopping, for sleeping workers
+    std::mutex _mutex;
+    std::condition_variable _wake;
+
+    /// How many tasks are on the queues
+    size_t _queued;
+
+    bool _stopping;
+
+    std::vector<std::thread> _workers;
+};
+
+inline VarTableExecutor* VarTableExecutor::defaultExecutor()
+{
+    static VarTableThreadPool pool;
+    return &pool;
+}
+
+/**
+ * Hashes cell values
+ *
+ * Strings (including C strings) are hashed by their contents, in place.
+ * Numbers are hashed by their value, so 0.0 and -0.0 hash the same.
+ */
+struct VarTableHash
+{
+    /**
+     * Scramble the bits of a 64-bit value (the MurmurHash3 finalizer)
+     */
+    static uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /**
+     * Fold the hash of one more value into a running hash
+     */
+    static uint64_t combine(uint64_t h, uint64_t value)
+    {
+        return (h ^ value) * 0x9e3779b97f4a7c15ULL + 0x632be59bd9b4e019ULL;
+    }
+
+    /**
+     * Hash a run of bytes, eight at a time
+     */
+    static uint64_t bytes(const char* data, size_t size)
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ULL ^ size;
+
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data, 8);
+            h = combine(h, word);
+        }
+
+        uint64_t tail = 0;
+        std::memcpy(&tail, data, size);
+
+        return mix(combine(h, tail));
+    }
+
+    /// Numbers
+    template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+    size_t operator()(T value) const
+    {
+        // Otherwise -0.0 and 0.0 would hash differently
+        if (value == 0)
+            value = 0;
+
+        static_assert(sizeof(T) <= sizeof(uint64_t), "Numbers wider than 64 bits need their own hash");
+
+        uint64_t bits = 0;
+        std::memcpy(&bits, &value, sizeof(T));
+        return mix(bits);
+    }
+
+    /// Long doubles are padded with bytes that aren't part of the value: hash it as a double instead
+    size_t operator()(long double value) const { return (*this)(static_cast<double>(value)); }
+
+    /// Strings
+    template <class Allocator>
+    size_t operator()(const std::basic_string<char, std::char_traits<char>, Allocator>& value) const
+    {
+        return bytes(value.data(), value.size());
+    }
+
+    /// C strings (null is a key of its own)
+    size_t operator()(const char* value) const { return value ? bytes(value, std::strlen(value)) : 0; }
+
+    /// Anything else that std::hash knows about
+    template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+    size_t operator()(const T& value) const
+    {
+        return mix(std::hash<T>()(value));
+    }
+};
+
+/**
+ * Compares cell values: C strings are compared by their contents
+ */
+struct VarTableEqual
+{
+    template <class T>
+    bool operator()(const T& a, const T& b) const
+    {
+        return a == b;
+    }
+
+    bool operator()(const char* a, const char* b) const { return a && b ? std::strcmp(a, b) == 0 : a == b; }
+};
+
+/**
+ * A blocked Bloom filter of 64-bit hashes
+ *
+ * Each key sets its bits within a single 64 byte block, so every lookup
+ * touches exactly one cache line.  The memory used is fixed when the filter
+ * is made and never grows.
+ */
+class VarTableBloomFilter
+{
+public:
+    /**
+     * Make a filter sized for the expected number of keys
+     *
+     * @param expected_keys How many distinct keys will be inserted
+     * @param false_positive_rate How often a new key may be mistaken for one already seen
+     */
+    VarTableBloomFilter(size_t expected_keys, double false_positive_rate)
+    {
+        assert(false_positive_rate > 0 && false_positive_rate < 1);
+
+        // The optimal bits per key (plus a bit extra: blocking raises the false positive rate)
+        const double ln2 = std::log(2.0);
+        double bits_per_key = 1.2 * -std::log(false_positive_rate) / (ln2 * ln2);
+
+        _num_hashes = std::min(8, std::max(1, static_cast<int>(std::lround(bits_per_key * ln2))));
+        _num_blocks = std::max<size_t>(1, static_cast<size_t>(expected_keys * bits_per_key / _block_bits) + 1);
+
+        // Over-allocate so the blocks can start on a cache line
+        _words.assign(_num_blocks * _block_words + _block_words, 0);
+        _first_word = 0;
+        while (reinterpret_cast<uintptr_t>(&_words[_first_word]) % (_block_words * sizeof(uint64_t)))
+            _first_word++;
+    }
+
+    /**
+     * Add a key to the filter
+     *
+     * @return False if the key (probably) was already there
+     */
+    bool insert(uint64_t hash)
+    {
+        // The high bits pick the block (without a division), the rest pick the bits within it
+        auto block = &_words[_first_word + ((hash >> 32) * _num_blocks >> 32) * _block_words];
+        auto bits = VarTableHash::mix(hash);
+
+        bool added = false;
+        for (int i = 0; i < _num_hashes; i++, bits >>= 9)
+        {
+            // 64 bits make 7 probes: mix up some more for the rest
+            if (i > 0 && i % 7 == 0)
+                bits = VarTableHash::mix(hash + i);
+
+            auto bit = bits & (_block_bits - 1);
+            auto mask = uint64_t(1) << (bit % 64);
+
+            if (!(block[bit / 64] & mask))
+            {
+                block[bit / 64] |= mask;
+                added = true;
+            }
+        }
+
+        return added;
+    }
+
+    /**
+     * Bytes used by the filter
+     */
+    size_t memory() const { return _words.size() * sizeof(uint64_t); }
+
+protected:
+    /// 64 bit words in a block
+    static const size_t _block_words = 8;
+
+    /// Bits in a block
+    static const size_t _block_bits = 512;
+
+    /// The blocks
+    std::vector<uint64_t> _words;
+
+    /// Where the first (cache line aligned) block starts in _words
+    size_t _first_word;
+
+    /// How many blocks there are
+    size_t _num_blocks;
+
+    /// How many bits each key sets
+    int _num_hashes;
+};
+
+/**
+ * A hierarchical timer wheel
+ *
+ * Timers are identified by small integers (e.g. row numbers) and fire on a
+ * tick.  Scheduling, cancelling and firing a timer are all O(1): advancing the
+ * wheel only touches the timers that fire, plus one bucket per level each time
+ * a lower level wraps around.
+ */
+class VarTableTimerWheel
+{
+public:
+    /// Means "no timer"
+    static const size_t npos = static_cast<size_t>(-1);
+
+    VarTableTimerWheel() : _now(0), _count(0), _heads(_levels * _slots, size_t(npos)) {}
+
+    /**
+     * The tick the wheel will process next
+     */
+    uint64_t now() const { return _now; }
+
+    /**
+     * The number of timers waiting to fire
+     */
+    size_t size() const { return _count; }
+
+    /**
+     * Start a timer (or move it, if it's already running)
+     *
+     * @param id The timer
+     * @param tick When it should fire: ticks in the past fire on the next advance()
+     */
+    void schedule(size_t id, uint64_t tick)
+    {
+        if (id >= _expiry.size())
+        {
+            _expiry.resize(id + 1, 0);
+            _next.resize(id + 1, size_t(npos));
+            _prev.resize(id + 1, size_t(npos));
+            _bucket.resize(id + 1, size_t(npos));
+        }
+
+        cancel(id);
+
+        _expiry[id] = tick;
+        link(id);
+        _count++;
+    }
+
+    /**
+     * Stop a timer (if it's running)
+     */
+    void cancel(size_t id)
+    {
+        if (id >= _bucket.size() || _bucket[id] == npos)
+            return;
+
+        unlink(id);
+        _count--;
+    }
+
+    /**
+     * Fire every timer due up to and including tick
+     *
+     * @param expire Called with the id of each timer that fires
+     * @return The number of timers that fired
+     */
+    template <class Callback>
+    size_t advance(uint64_t tick, Callback expire)
+    {
+        size_t fired = 0;
+
+        // Nothing to fire: skip straight there
+        if (_count == 0 && _now <= tick)
+            _now = tick + 1;
+
+        for (; _now <= tick; _now++)
+        {
+            // Each time a level wraps around, spread the next bucket of the level above over it
+            auto index = _now & (_slots - 1);
+            for (size_t level = 1; index == 0 && level < _levels; level++)
+            {
+                index = (_now >> (_bits * level)) & (_slots - 1);
+                cascade(level * _slots + index);
+            }
+
+            auto bucket = _now & (_slots - 1);
+            while (_heads[bucket] != npos)
+            {
+                auto id = _heads[bucket];
+                unlink(id);
+                _count--;
+                fired++;
+                expire(id);
+            }
+        }
+
+        return fired;
+    }
+
+protected:
+    /// Bits of the tick used by each level
+    static const unsigned int _bits = 8;
+
+    /// Buckets in each level
+    static const size_t _slots = 256;
+
+    /// Number of levels: timers up to 2^32 ticks away
+    static const size_t _levels = 4;
+
+    /**
+     * Put a timer in the bucket for its tick
+     */
+    void link(size_t id)
+    {
+        auto tick = std::max(_expiry[id], _now);
+        auto delta = tick - _now;
+
+        size_t level = 0;
+        while (level + 1 < _levels && delta >= (uint64_t(1) << (_bits * (level + 1))))
+            level++;
+
+        // Too far away for the wheel: park it in the furthest bucket, it'll be cascaded back
+        if (delta >= (uint64_t(1) << (_bits * _levels)))
+            tick = _now + (uint64_t(1) << (_bits * _levels)) - 1;
+
+        auto bucket = level * _slots + ((tick >> (_bits * level)) & (_slots - 1));
+
+        _bucket[id] = bucket;
+        _prev[id] = npos;
+        _next[id] = _heads[bucket];
+        if (_heads[bucket] != npos)
+            _prev[_heads[bucket]] = id;
+        _heads[bucket] = id;
+    }
+
+    /**
+     * Take a timer out of its bucket
+     */
+    void unlink(size_t id)
+    {
+        if (_prev[id] != npos)
+            _next[_prev[id]] = _next[id];
+        else
+            _heads[_bucket[id]] = _next[id];
+
+        if (_next[id] != npos)
+            _prev[_next[id]] = _prev[id];
+
+        _bucket[id] = npos;
+    }
+
+    /**
+     * Move every timer in a bucket down to the level it now belongs in
+     */
+    void cascade(size_t bucket)
+    {
+        auto id = _heads[bucket];
+        _heads[bucket] = npos;
+
+        while (id != npos)
+        {
+            auto next = _next[id];
+            link(id);
+            id = next;
+        }
+    }
+
+    /// The next tick to process
+    uint64_t _now;
+
+    /// Number of running timers
+    size_t _count;
+
+    /// The first timer in each bucket
+    std::vector<size_t> _heads;
+
+    /// The tick each timer fires on
+    std::vector<uint64_t> _expiry;
+
+    /// The next timer in the same bucket
+    std::vector<size_t> _next;
+
+    /// The previous timer in the same bucket
+    std::vector<size_t> _prev;
+
+    /// The bucket each timer is in (npos if it isn't running)
+    std::vector<size_t> _bucket;
+};
+
+/**
+ * Counts how many cells of each column are each width
+ *
+ * Lets the width of a column be kept up to date as cells come and go,
+ * without looking at every cell again.
+ */
+class VarTableWidthHistogram
+{
+public:
+    /**
+     * Forget every cell
+     */
+    void reset(size_t num_columns)
+    {
+        _counts.assign(num_columns, std::vector<size_t>());
+        _max.assign(num_columns, 0);
+    }
+
+    /**
+     * Count a row of cells with these widths
+     */
+    void add(const std::vector<unsigned int>& sizes)
+    {
+        for (size_t c = 0; c < _counts.size(); c++)
+        {
+            if (_counts[c].size() <= sizes[c])
+                _counts[c].resize(sizes[c] + 1, 0);
+
+            _counts[c][sizes[c]]++;
+            _max[c] = std::max(_max[c], sizes[c]);
+        }
+    }
+
+    /**
+     * Stop counting a row of cells with these widths
+     */
+    void remove(const std::vector<unsigned int>& sizes)
+    {
+        for (size_t c = 0; c < _counts.size(); c++)
+        {
+            assert(_counts[c][sizes[c]] > 0);
+            _counts[c][sizes[c]]--;
+
+            while (_max[c] > 0 && _counts[c][_max[c]] == 0)
+                _max[c]--;
+        }
+    }
+
+    /**
+     * The widest cell in a column (0 if there are none)
+     */
+    unsigned int max(size_t column) const { return _max[column]; }
+
+protected:
+    /// How many cells there are of each width, for each column
+    std::vector<std::vector<size_t>> _counts;
+
+    /// The widest cell in each column
+    std::vector<unsigned int> _max;
+};
+
+/**
+ * Builds a FlatBuffer (the encoding of Arrow's metadata) front to back
+ *
+ * Only what the Arrow IPC writer needs: tables of scalars and offsets,
+ * strings, and vectors of offsets or structs.  References must point
+ * forwards, so a parent is written first and the offsets in it are patched
+ * once its children have been written after it.
+ */
+class VarTableFlatBuilder
+{
+public:
+    /**
+     * A field of a table: a little endian scalar, or an offset to patch later
+     */
+    struct Field
+    {
+        /// The field's id in the schema
+        unsigned int id;
+
+        /// Its size in bytes (4 for offsets)
+        unsigned int size;
+
+        /// Its value (ignored for offsets)
+        uint64_t value;
+
+        /// Whether it's an offset
+        bool offset;
+    };
+
+    /// A scalar field
+    static Field scalar(unsigned int id, unsigned int size, uint64_t value)
+    {
+        Field field = { id, size, value, false };
+        return field;
+    }
+
+    /// An offset field
+    static Field offset(unsigned int id)
+    {
+        Field field = { id, 4, 0, true };
+        return field;
+    }
+
+    /**
+     * Start again with an empty buffer (just the offset to the root table)
+     */
+    void clear() { _buffer.assign(4, 0); }
+
+    /**
+     * The buffer built so far
+     */
+    const std::vector<char>& buffer() const { return _buffer; }
+
+    /**
+     * Point the buffer at its root table
+     */
+    void setRoot(size_t table) { patch(0, table); }
+
+    /**
+     * Point an offset written earlier at something written since
+     */
+    void patch(size_t slot, size_t target)
+    {
+        uint32_t offset = static_cast<uint32_t>(target - slot);
+        std::memcpy(&_buffer[slot], &offset, 4);
+    }
+
+    /**
+     * Write a table (and its vtable, just before it)
+     *
+     * @param fields The fields that are present
+     * @param slots Filled with the position of each offset field, by id, to patch later
+     * @return Where the table starts
+     */
+    size_t table(std::vector<Field> fields, std::vector<size_t>& slots)
+    {
+        unsigned int num_fields = 0;
+        for (auto& field : fields)
+            num_fields = std::max(num_fields, field.id + 1);
+
+        // The vtable: its size, the table's size, then where each field is in the table
+        align(2);
+        auto vtable = _buffer.size();
+        _buffer.resize(vtable + 4 + 2 * num_fields, 0);
+
+        // The table starts with the distance back to its vtable
+        align(8);
+        auto table = _buffer.size();
+        put<int32_t>(static_cast<int32_t>(table - vtable));
+
+        // Biggest fields first, to waste less space on alignment
+        std::stable_sort(fields.begin(), fields.end(),
+            [](const Field& a, const Field& b) { return a.size > b.size; });
+
+        slots.assign(num_fields, 0);
+        for (auto& field : fields)
+        {
+            align(field.size);
+            auto position = _buffer.size();
+
+            _buffer.resize(position + field.size, 0);
+            if (!field.offset)
+                std::memcpy(&_buffer[position], &field.value, field.size); // Little endian
+            else
+                slots[field.id] = position;
+
+            put_at<uint16_t>(vtable + 4 + 2 * field.id, static_cast<uint16_t>(position - table));
+        }
+
+        put_at<uint16_t>(vtable, static_cast<uint16_t>(4 + 2 * num_fields));
+        put_at<uint16_t>(vtable + 2, static_cast<uint16_t>(_buffer.size() - table));
+
+        return table;
+    }
+
+    /**
+     * Write a string
+     */
+    size_t string(const std::string& text)
+    {
+        align(4);
+        auto position = _buffer.size();
+
+        put<uint32_t>(static_cast<uint32_t>(text.size()));
+        _buffer.insert(_buffer.end(), text.begin(), text.end());
+        _buffer.push_back('\0');
+
+        return position;
+    }
+
+    /**
+     * Write a vector of offsets, to be patched later
+     *
+     * @param first_slot Set to the position of the first offset: the rest follow 4 bytes apart
+     */
+    size_t offsets(size_t count, size_t& first_slot)
+    {
+        align(4);
+        auto position = _buffer.size();
+
+        put<uint32_t>(static_cast<uint32_t>(count));
+        first_slot = _buffer.size();
+        _buffer.resize(first_slot + 4 * count, 0);
+
+        return position;
+    }
+
+    /**
+     * Write a vector of structs (8 byte aligned)
+     */
+    size_t structs(const void* data, size_t count, size_t struct_size)
+    {
+        // The length comes just before the first struct, which must be aligned
+        align(8, 4);
+        auto position = _buffer.size();
+
+        put<uint32_t>(static_cast<uint32_t>(count));
+        auto bytes = static_cast<const char*>(data);
+        _buffer.insert(_buffer.end(), bytes, bytes + count * struct_size);
+
+        return position;
+    }
+
+    /**
+     * Pad with zeros so that the buffer's size plus extra is a multiple of alignment
+     */
+    void align(size_t alignment, size_t extra = 0)
+    {
+        while ((_buffer.size() + extra) % alignment)
+            _buffer.push_back('\0');
+    }
+
+protected:
+    template <class T>
+    void put(T value)
+    {
+        auto position = _buffer.size();
+        _buffer.resize(position + sizeof(T));
+        put_at(position, value);
+    }
+
+    template <class T>
+    void put_at(size_t position, T value)
+    {
+        std::memcpy(&_buffer[position], &value, sizeof(T));
+    }
+
+    /// The buffer being built
+    std::vector<char> _buffer;
+};
+
+/**
+ * Reads a table in a FlatBuffer, checking that everything is in bounds
+ */
+class VarTableFlatTable
+{
+public:
+    VarTableFlatTable() : _data(nullptr), _size(0), _position(0) {}
+
+    /**
+     * Find the root table of a buffer
+     */
+    static bool root(const char* data, size_t size, VarTableFlatTable& table)
+    {
+        uint32_t offset;
+        if (!read(data, size, 0, offset))
+            return false;
+
+        return at(data, size, offset, table);
+    }
+
+    /**
+     * Read a scalar field
+     */
+    template <class T>
+    T scalar(unsigned int id, T default_value) const
+    {
+        size_t position;
+        T value;
+        if (!field(id, position) || !read(_data, _size, position, value))
+            return default_value;
+
+        return value;
+    }
+
+    /**
+     * Follow an offset field to another table
+     */
+    bool table(unsigned int id, VarTableFlatTable& table) const
+    {
+        size_t position;
+        return field(id, position) && follow(position, table);
+    }
+
+    /**
+     * Follow an offset field to a vector
+     *
+     * @param elements Set to where the first element is
+     * @param count Set to the number of elements
+     */
+    bool vector(unsigned int id, size_t& elements, uint32_t& count) const
+    {
+        size_t position;
+        uint32_t offset;
+        if (!field(id, position) || !read(_data, _size, position, offset) ||
+            !read(_data, _size, position + offset, count))
+            return false;
+
+        elements = position + offset + 4;
+        return elements <= _size;
+    }
+
+    /**
+     * Follow an offset field to a string
+     */
+    bool string(unsigned int id, std::string& text) const
+    {
+        size_t elements;
+        uint32_t count;
+        if (!vector(id, elements, count) || count > _size - elements)
+            return false;
+
+        text.assign(_data + elements, count);
+        return true;
+    }
+
+    /**
+     * Follow the offset at position (e.g. an element of a vector of tables) to a table
+     */
+    bool follow(size_t position, VarTableFlatTable& table) const
+    {
+        uint32_t offset;
+        return read(_data, _size, position, offset) && at(_data, _size, position + offset, table);
+    }
+
+    /**
+     * The buffer the table is in
+     */
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    /**
+     * Read a value anywhere in a buffer
+     */
+    template <class T>
+    static bool read(const char* data, size_t size, size_t position, T& value)
+    {
+        if (position > size || size - position < sizeof(T))
+            return false;
+
+        std::memcpy(&value, data + position, sizeof(T));
+        return true;
+    }
+
+protected:
+    /**
+     * The table that starts at position
+     */
+    static bool at(const char* data, size_t size, size_t position, VarTableFlatTable& table)
+    {
+        int32_t vtable_offset;
+        if (!read(data, size, position, vtable_offset))
+            return false;
+
+        table._data = data;
+        table._size = size;
+        table._position = position;
+        table._vtable = position - vtable_offset;
+
+        uint16_t vtable_size;
+        return read(data, size, table._vtable, vtable_size) && table._vtable + vtable_size <= size;
+    }
+
+    /**
+     * Find where a field is (false if it isn't present)
+     */
+    bool field(unsigned int id, size_t& position) const
+    {
+        uint16_t vtable_size, offset;
+        if (!read(_data, _size, _vtable, vtable_size) || 4u + 2 * id + 2 > vtable_size ||
+            !read(_data, _size, _vtable + 4 + 2 * id, offset) || offset == 0)
+            return false;
+
+        position = _position + offset;
+        return true;
+    }
+
+    const char* _data;
+    size_t _size;
+    size_t _position;
+    size_t _vtable;
+};
+
+/**
+ * How a C++ type is stored in Arrow
+ *
+ * Anything that isn't a number or a bool is stored as UTF-8 text.
+ */
+template <class T, class Enable = void>
+struct VarTableArrowTraits
+{
+    /// The Arrow Type union id: Utf8
+    static const unsigned char type = 5;
+};
+
+/// bool: Bool (bit packed)
+template <>
+struct VarTableArrowTraits<bool>
+{
+    static const unsigned char type = 6;
+};
+
+/// Integers: Int
+template <class T>
+struct VarTableArrowTraits<T,
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static const unsigned char type = 2;
+    typedef T storage;
+};
+
+/// Floating point: FloatingPoint (long double is stored as double)
+template <class T>
+struct VarTableArrowTraits<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static const unsigned char type = 3;
+    typedef typename std::conditional<sizeof(T) == sizeof(float), float, double>::type storage;
+};
+
+/**
+ * The formats a table can be exported to incrementally
+ */
+enum class VarTableFileFormat
+{
+    CSV,   // A header line, then a line for each row
+    BINARY // The columns' types, then blocks of rows, then an index of the blocks
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * A file that a table is exported to a few new rows at a time (see VarTable::exportAppend)
+ *
+ * It remembers how many rows have been exported and where the file's data
+ * ends, both in memory and in a small sidecar state file that is replaced
+ * after every export.  Opening the file again after a restart carries on from
+ * the state file, dropping anything an interrupted export left behind.
+ *
+ * A BINARY file is:
+ *   "VTAB0001", a uint32 header size, the header (see VarTable::exportAppend)
+ *   blocks of rows, each a uint64 row count and a uint64 size then the rows
+ *   the index: (uint64 offset, uint64 first row, uint64 row count) for each block,
+ *   then a uint64 block count and "VTABIDX1"
+ * The index is rewritten in place after each export, over the end of the last one.
+ */
+class VarTableAppendFile
+{
+public:
+    VarTableAppendFile() : _fd(-1), _format(VarTableFileFormat::CSV), _rows(0), _data_end(0) {}
+
+    ~VarTableAppendFile() { close(); }
+
+    VarTableAppendFile(const VarTableAppendFile&) = delete;
+    VarTableAppendFile& operator=(const VarTableAppendFile&) = delete;
+
+    /**
+     * Open the file, carrying on from its state file if there is one
+     *
+     * Without a state file the file must be new or empty.
+     *
+     * @param path The file to export to
+     * @param format Its format
+     * @param state_path Where to keep the state (default: path + ".state")
+     * @return false if the file can't be opened, doesn't match its state or has data but no state
+     */
+    bool open(const std::string& path, VarTableFileFormat format, const std::string& state_path = "")
+    {
+        close();
+
+        _format = format;
+        _state_path = state_path.empty() ? path + ".state" : state_path;
+        _rows = 0;
+        _data_end = 0;
+        _index.clear();
+
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (_fd < 0)
+            return false;
+
+        if (!load_state() || ftruncate(_fd, static_cast<off_t>(_data_end)) != 0 ||
+            (_format == VarTableFileFormat::BINARY && _data_end && (!read_index() || !write_index())))
+        {
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Close the file (the state file is kept, to carry on from)
+     */
+    void close()
+    {
+        if (_fd >= 0)
+            ::close(_fd);
+
+        _fd = -1;
+    }
+
+    /**
+     * Whether the file is open
+     */
+    bool isOpen() const { return _fd >= 0; }
+
+    /**
+     * The file's format
+     */
+    VarTableFileFormat format() const { return _format; }
+
+    /**
+     * The number of rows exported so far (the high-water mark)
+     */
+    uint64_t rows() const { return _rows; }
+
+    /**
+     * Where the data ends: the file's size, without a BINARY file's index
+     */
+    uint64_t dataEnd() const { return _data_end; }
+
+    /**
+     * Write some rows after the ones already in the file
+     *
+     * They aren't kept after a restart until commit() is called.
+     *
+     * @param header Written first if the file is empty
+     * @param data The rows, already in the file's format
+     * @param rows The number of rows
+     */
+    bool append(const std::string& header, const std::string& data, uint64_t rows)
+    {
+        assert(isOpen());
+
+        auto data_end = _data_end;
+        if (data_end == 0)
+        {
+            std::string start;
+            if (_format == VarTableFileFormat::BINARY)
+            {
+                start = "VTAB0001";
+                put(start, static_cast<uint32_t>(header.size()));
+            }
+            start += header;
+
+            if (!write_at(data_end, start))
+                return false;
+            data_end += start.size();
+        }
+
+        // The block is only indexed once it's all written
+        auto block_start = data_end;
+        if (_format == VarTableFileFormat::BINARY)
+        {
+            std::string block;
+            put(block, rows);
+            put(block, static_cast<uint64_t>(data.size()));
+
+            if (!write_at(data_end, block))
+                return false;
+
+            data_end += block.size();
+        }
+
+        if (!write_at(data_end, data))
+            return false;
+
+        if (_format == VarTableFileFormat::BINARY)
+        {
+            Block index_entry = { block_start, _rows, rows };
+            _index.push_back(index_entry);
+        }
+
+        _data_end = data_end + data.size();
+        _rows += rows;
+
+        return _format != VarTableFileFormat::BINARY || write_index();
+    }
+
+    /**
+     * Make sure everything appended is on disk, then record it in the state file
+     */
+    bool commit()
+    {
+        assert(isOpen());
+
+        if (fsync(_fd) != 0)
+            return false;
+
+        // Replace the state file in one step, so it's never half written
+        auto temp_path = _state_path + ".tmp";
+        int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        std::ostringstream state;
+        state << "VarTableAppendFile 1 " << (_format == VarTableFileFormat::BINARY ? "binary" : "csv")
+              << " " << _rows << " " << _data_end << "\n";
+
+        bool written = write_at(fd, 0, state.str()) && fsync(fd) == 0;
+        ::close(fd);
+
+        return written && rename(temp_path.c_str(), _state_path.c_str()) == 0;
+    }
+
+protected:
+    /**
+     * An entry in a BINARY file's index
+     */
+    struct Block
+    {
+        uint64_t offset;
+        uint64_t first_row;
+        uint64_t rows;
+    };
+
+    template <class T>
+    static void put(std::string& buffer, T value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    bool write_at(uint64_t offset, const std::string& data) { return write_at(_fd, offset, data); }
+
+    static bool write_at(int fd, uint64_t offset, const std::string& data)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+            auto count = pwrite(fd, data.data() + written, data.size() - written, static_cast<off_t>(offset + written));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+
+            written += static_cast<size_t>(count);
+        }
+
+        return true;
+    }
+
+    bool read_at(uint64_t offset, void* data, size_t size)
+    {
+        return pread(_fd, data, size, static_cast<off_t>(offset)) == static_cast<ssize_t>(size);
+    }
+
+    /**
+     * Read the state file, if there is one, and check it fits the file
+     *
+     * Without one the file must be empty: data of unknown extent isn't thrown away.
+     */
+    bool load_state()
+    {
+        struct stat info;
+        if (fstat(_fd, &info) != 0)
+            return false;
+
+        std::ifstream in(_state_path);
+        if (!in)
+            return info.st_size == 0;
+
+        std::string magic, format;
+        int version = 0;
+        in >> magic >> version >> format >> _rows >> _data_end;
+
+        return in && magic == "VarTableAppendFile" && version == 1 &&
+            format == (_format == VarTableFileFormat::BINARY ? "binary" : "csv") &&
+            static_cast<uint64_t>(info.st_size) >= _data_end;
+    }
+
+    /**
+     * Find the blocks of a BINARY file by walking from one to the next
+     */
+    bool read_index()
+    {
+        char magic[8];
+        uint32_t header_size;
+        if (!read_at(0, magic, 8) || std::memcmp(magic, "VTAB0001", 8) != 0 || !read_at(8, &header_size, 4))
+            return false;
+
+        uint64_t rows = 0;
+        for (uint64_t offset = 12 + header_size; offset < _data_end;)
+        {
+            uint64_t block[2];
+            if (offset + sizeof(block) > _data_end || !read_at(offset, block, sizeof(block)) ||
+                block[1] > _data_end - offset - sizeof(block))
+                return false;
+
+            Block index_entry = { offset, rows, block[0] };
+            _index.push_back(index_entry);
+
+            rows += block[0];
+            offset += sizeof(block) + block[1];
+        }
+
+        return rows == _rows;
+    }
+
+    /**
+     * Write a BINARY file's index after its data
+     */
+    bool write_index()
+    {
+        std::string index;
+        for (auto& block : _index)
+        {
+            put(index, block.offset);
+            put(index, block.first_row);
+            put(index, block.rows);
+        }
+        put(index, static_cast<uint64_t>(_index.size()));
+        index += "VTABIDX1";
+
+        return write_at(_data_end, index) && ftruncate(_fd, static_cast<off_t>(_data_end + index.size())) == 0;
+    }
+
+    /// The file
+    int _fd;
+
+    /// Its format
+    VarTableFileFormat _format;
+
+    /// Where its state is kept
+    std::string _state_path;
+
+    /// The number of rows in it
+    uint64_t _rows;
+
+    /// Where its data ends
+    uint64_t _data_end;
+
+    /// Where each block of a BINARY file is
+    std::vector<Block> _index;
+};
+#endif
+
+/**
+ * The type a column is summed in: 64 bit integers, or at least a double
+ */
+template <class T, class Enable = void>
+struct VarTableAccumulator
+{
+    typedef typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type type;
+};
+
+template <class T>
+struct VarTableAccumulator<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    typedef typename std::conditional<sizeof(T) <= sizeof(double), double, T>::type type;
+};
+
+/**
+ * Whether a type is text: C strings and std::basic_string of char
+ */
+template <class T>
+struct VarTableIsText : std::false_type
+{
+};
+
+template <>
+struct VarTableIsText<const char*> : std::true_type
+{
+};
+
+template <class Traits, class Allocator>
+struct VarTableIsText<std::basic_string<char, Traits, Allocator>> : std::true_type
+{
+};
+
+/**
+ * A list of column indices
+ *
+ * (std::index_sequence is C++14)
+ */
+template <std::size_t... I>
+struct VarTableIndexList
+{
+};
+
+/**
+ * Makes VarTableIndexList<0, 1, ..., N - 1>
+ */
+template <std::size_t N, std::size_t... I>
+struct VarTableMakeIndexList : VarTableMakeIndexList<N - 1, N - 1, I...>
+{
+};
+
+template <std::size_t... I>
+struct VarTableMakeIndexList<0, I...>
+{
+    typedef VarTableIndexList<I...> type;
+};
+
+/**
+ * The kinds of change recorded in a table's change feed
+ */
+enum class VarTableChangeType
+{
+    ROW_ADDED,    // A row was added
+    ROW_CHANGED,  // Every cell of a row was replaced
+    CELL_CHANGED, // A single cell was changed
+    ROW_REMOVED   // A row was removed
+};
+
+/**
+ * Whether a subscriber to a change feed is keeping up
+ */
+enum class VarTableFeedStatus
+{
+    OK,    // The changes since the cursor have been read
+    BEHIND // Changes were overwritten before they were read: start again from a snapshot
+};
+
+/**
+ * One change to a table (see VarTable::enableChangeFeed)
+ */
+template <class DataTuple>
+struct VarTableChange
+{
+    /// The position of the change in the feed
+    uint64_t sequence;
+
+    /// What happened
+    VarTableChangeType type;
+
+    /// The row it happened to: the row's index, or its slot if rows can expire
+    size_t row;
+
+    /// The column changed (CELL_CHANGED only)
+    size_t column;
+
+    /// The new values: for CELL_CHANGED only the changed column is set, for ROW_REMOVED none are
+    DataTuple values;
+};
+
+/**
+ * Whether a type is a std::atomic
+ */
+template <class T>
+struct VarTableIsAtomic : std::false_type
+{
+};
+
+template <class T>
+struct VarTableIsAtomic<std::atomic<T>> : std::true_type
+{
+};
+
+/**
+ * A single cell of a bound row (see VarTable::bindRow)
+ *
+ * The cell is either a fixed value, an atomic that is read with a relaxed load,
+ * or a callback that is invoked every time the table is rendered.
+ *
+ * Atomics are referenced, not copied: they must outlive the table.  An atomic
+ * of another type is converted to the column's type each time it's read.
+ */
+template <class T>
+class VarTableBinding
+{
+public:
+    /// A cell that always shows the same value (never an atomic's value at the time it's bound)
+    template <class U,
+        typename = typename std::enable_if<std::is_convertible<const U&, T>::value &&
+        !VarTableIsAtomic<U>::value>::type>
+        VarTableBinding(const U& value)
+        : _source(nullptr), _reader(nullptr), _value(value)
+    {
+    }
+
+    /// A cell that shows the current value of an atomic
+    template <class U, typename std::enable_if<std::is_convertible<U, T>::value, int>::type = 0>
+    VarTableBinding(const std::atomic<U>& source)
+        : _source(&source), _reader(&VarTableBinding::read_atomic<U>), _value()
+    {
+    }
+
+    /// An atomic whose values can't go in the column
+    template <class U, typename std::enable_if<!std::is_convertible<U, T>::value, int>::type = 0>
+    VarTableBinding(const std::atomic<U>& source) = delete;
+
+    /// A cell that shows whatever the callback returns
+    template <class F,
+        typename = typename std::enable_if<
+        std::is_convertible<decltype(std::declval<F&>()()), T>::value>::type>
+        VarTableBinding(F callback)
+        : _source(nullptr), _reader(nullptr), _value(), _callback(std::move(callback))
+    {
+    }
+
+    /**
+     * Read the current value of the cell into out
+     */
+    void load(T& out) const
+    {
+        if (_reader)
+            out = _reader(_source);
+        else if (_callback)
+            out = _callback();
+        else
+            out = _value;
+    }
+
+protected:
+    /**
+     * Reads an atomic with a relaxed load
+     *
+     * Only instantiated for types that std::atomic accepts.
+     */
+    template <class U>
+    static T read_atomic(const void* source)
+    {
+        return static_cast<T>(static_cast<const std::atomic<U>*>(source)->load(std::memory_order_relaxed));
+    }
+
+    /// The atomic to read from (if any)
+    const void* _source;
+
+    /// Reads _source
+    T (*_reader)(const void*);
+
+    /// The fixed value (if neither an atomic nor a callback)
+    T _value;
+
+    /// The callback to invoke (if any)
+    std::function<T()> _callback;
+};
+
+/**
+ * A class for printing a table on Shell.
+ *
+ * Requries C++11 (and nothing more)
+ *
+ * You can use the header file below:
+ *
+ * VarTable<std::string, double, int, std::string> vt({"Name", "Weight", "Age", "Brother"});
+ * vt.addRow("Fred", 193.4, 35, "Sam");
+ * vt.print(std::cout);
+ */
+template <class... Ts>
+class VarTable
+{
+    // Views (see materialize) are tables of other types
+    template <class... Us>
+    friend class VarTable;
+
+public:
+    /// The type stored for each row
+    typedef std::tuple<Ts...> DataTuple;
+
+    /// Rows are allocated from the table's memory resource, and so are the cells that take an allocator
+    typedef std::scoped_allocator_adaptor<VarTableAllocator<DataTuple>> RowAllocator;
+
+    /// A vector of rows
+    typedef std::vector<DataTuple, RowAllocator> RowVector;
+
+    /**
+     * Construct the table with headers
+     *
+     * @param headers The names of the columns
+     * @param static_column_size The size of columns that can't be found automatically
+     * @param resource Where the rows (and VarTableString cells) are allocated from
+     */
+    VarTable(std::vector<std::string> headers,
+        unsigned int static_column_size = 0,
+        unsigned int cell_padding = 1,
+        VarTableMemoryResource* resource = VarTableMemoryResource::defaultResource())
+        : _headers(headers),
+        _num_columns(std::tuple_size<DataTuple>::value),
+        _static_column_size(static_column_size),
+        _cell_padding(cell_padding),
+        _data(RowAllocator(resource)),
+        _snapshot(RowAllocator(resource)),
+        _write_snapshot(RowAllocator(resource)),
+        _write_version(0),
+        _write_layout(0),
+        _print_style(PrintStyle::BASIC),
+        _sort_less(nullptr),
+        _sorted_size(0),
+        _last_chunk(0),
+        _expiry_enabled(false),
+        _live_rows_dirty(false),
+        _feed_capacity(0),
+        _feed_next(0),
+        _feed_first(0),
+        _version(0),
+        _style_block_first(0),
+        _style_block_rows(0),
+        _row_styles(nullptr),
+        _spare_rows(RowAllocator(resource)),
+        _spare_next(0),
+        _line_cache_style(PrintStyle::BASIC),
+        _line_buffer_line(std::numeric_limits<size_t>::max()),
+        _tree_enabled(false),
+        _tree_levels(0),
+        _tree_dirty(false),
+        _row_prefix(nullptr),
+        _row_prefix_size(0),
+        _executor(nullptr)
+    {
+        assert(headers.size() == _num_columns);
+    }
+
+    /**
+     * Add a row of data
+     *
+     * @param data A Tuple of data to add
+     */
+    void addRow(Ts... entries) { store_row(std::make_tuple(entries...)); }
+
+    /**
+     * Start rebuilding the table in place, for tables rebuilt from scratch every tick
+     *
+     * The rows are emptied but kept, with the capacity of their strings, and
+     * setRow() assigns the new values into them.  Once the table is its usual
+     * size, rebuilding it (and printing it, if the widths don't change)
+     * doesn't allocate.
+     *
+     * vt.resetForRebuild();
+     * for (size_t i = 0; i < hosts.size(); i++)
+     *     vt.setRow(i, hosts[i].name, hosts[i].load);
+     *
+     * Can't be used with setSortedInsert() or enableExpiry().
+     */
+    void resetForRebuild()
+    {
+        assert(!_sort_less && !_expiry_enabled && !_concurrent && !_tree_enabled);
+        _version++;
+        mark_views_stale();
+
+        if (_feed_capacity)
+            for (size_t r = _data.size(); r-- > 0;)
+                record_change(VarTableChangeType::ROW_REMOVED, r, 0);
+
+        // The old rows become the spares, and the old spares' storage holds the new rows
+        _spare_rows.clear();
+        _data.swap(_spare_rows);
+        _spare_next = 0;
+    }
+
+    /**
+     * Overwrite a row, or add one at the end
+     *
+     * The values are assigned into the row, so strings reuse their capacity.
+     * A new row reuses a row kept by resetForRebuild() when there is one.
+     *
+     * Can't be used with setSortedInsert() or enableExpiry().  With
+     * enableConcurrentUpdates() only one thread may add rows this way, since
+     * the row must still be the next one when it's added: use addRow() from
+     * several.
+     *
+     * @param row The row's index: up to the number of rows, to add one
+     */
+    void setRow(size_t row, const Ts&... values)
+    {
+        if (_concurrent)
+        {
+            if (row == _concurrent->rows.load(std::memory_order_acquire))
+            {
+                size_t added = append_row(DataTuple(values...));
+                assert(added == row);
+                (void)added;
+                return;
+            }
+
+            update_concurrently(row, [&](DataTuple& stored) { stored = std::tie(values...); });
+            return;
+        }
+
+        assert(!_sort_less && !_expiry_enabled && row <= _data.size());
+        assert(!_tree_enabled || row < _data.size());
+        _version++;
+
+        auto type = VarTableChangeType::ROW_CHANGED;
+        if (row == _data.size())
+        {
+            type = VarTableChangeType::ROW_ADDED;
+
+            if (_spare_next == _spare_rows.size())
+                _data.emplace_back(values...);
+            else
+                _data.emplace_back(std::move(_spare_rows[_spare_next++]));
+        }
+
+        _data[row] = std::tie(values...);
+
+        if (type == VarTableChangeType::ROW_ADDED)
+            update_views(_data[row]);
+        else
+            mark_views_stale();
+
+        if (_feed_capacity)
+            record_change(type, row, 0).values = _data[row];
+    }
+
+    /**
+     * Let rows expire if they aren't refreshed
+     *
+     * Expiry times are kept in a timer wheel, so expire() only does work for the
+     * rows that actually expire.  Expired rows leave a slot that is reused by the
+     * next row added, and the width of each column is kept in a histogram so it
+     * never needs a full rescan.
+     *
+     * Can't be used with setSortedInsert().
+     *
+     * @param resolution How precisely expiry times are kept
+     */
+    void enableExpiry(std::chrono::steady_clock::duration resolution = std::chrono::seconds(1))
+    {
+        assert(!_sort_less && !_concurrent && !_tree_enabled);
+
+        _expiry_enabled = true;
+        _expiry_epoch = std::chrono::steady_clock::now();
+        _expiry_resolution = resolution;
+
+        // Every row already in the table is kept until it's refreshed
+        _alive.assign(_data.size(), 1);
+        _generations.assign(_data.size(), 0);
+        _free_slots.clear();
+        _live_rows_dirty = true;
+
+        rebuild_width_histogram();
+    }
+
+    /**
+     * Add a row that expires unless it's refreshed
+     *
+     * enableExpiry() must have been called.
+     *
+     * @param ttl How long until the row expires
+     * @return The row's handle: used to refresh it
+     */
+    VarTableRowHandle addRowExpiring(std::chrono::steady_clock::duration ttl, Ts... entries)
+    {
+        assert(_expiry_enabled);
+
+        auto slot = store_row(std::make_tuple(entries...));
+        _expiry_wheel.schedule(slot, expiry_tick(ttl));
+
+        return rowHandle(slot);
+    }
+
+    /**
+     * The handle of the row in a slot that holds one (e.g. a row added before enableExpiry())
+     */
+    VarTableRowHandle rowHandle(size_t slot) const
+    {
+        assert(_expiry_enabled && rowAlive(slot));
+
+        VarTableRowHandle handle = { slot, _generations[slot] };
+        return handle;
+    }
+
+    /**
+     * Put off a row expiring
+     *
+     * @param row The handle returned by addRowExpiring()
+     * @param ttl How long from now until the row expires
+     * @return False if the row has expired already (even if its slot holds another row now)
+     */
+    bool refreshRow(VarTableRowHandle row, std::chrono::steady_clock::duration ttl)
+    {
+        assert(_expiry_enabled);
+
+        if (!rowAlive(row))
+            return false;
+
+        _expiry_wheel.schedule(row.slot, expiry_tick(ttl));
+        return true;
+    }
+
+    /**
+     * Put off a row expiring and replace its values
+     *
+     * @param row The handle returned by addRowExpiring()
+     * @param ttl How long from now until the row expires
+     * @return False if the row has expired already
+     */
+    bool refreshRow(VarTableRowHandle row, std::chrono::steady_clock::duration ttl, Ts... entries)
+    {
+        if (!refreshRow(row, ttl))
+            return false;
+
+        replace_row(row.slot, std::make_tuple(entries...));
+        return true;
+    }
+
+    /**
+     * Change a single cell
+     *
+     * Can't be used with setSortedInsert().
+     *
+     * vt.setCell<1>(row, 42);
+     *
+     * @param row The row's index (or its slot if rows can expire)
+     * @param value The new value
+     */
+    template <std::size_t I>
+    void setCell(size_t row, const typename std::tuple_element<I, DataTuple>::type& value)
+    {
+        if (_concurrent)
+        {
+            update_concurrently(row, [&](DataTuple& stored) { std::get<I>(stored) = value; });
+            return;
+        }
+
+        assert(!_sort_less && row < _data.size());
+        _version++;
+        mark_views_stale();
+
+        if (_expiry_enabled)
+        {
+            size_each(_data[row], _row_sizes);
+            _width_histogram.remove(_row_sizes);
+        }
+
+        std::get<I>(_data[row]) = value;
+
+        if (_expiry_enabled)
+        {
+            size_each(_data[row], _row_sizes);
+            _width_histogram.add(_row_sizes);
+        }
+
+        if (_feed_capacity)
+            std::get<I>(record_change(VarTableChangeType::CELL_CHANGED, row, I).values) = value;
+    }
+
+    /**
+     * Let other threads add and change rows while the table is printed
+     *
+     * Each row is guarded by one of a set of striped locks, so writers only
+     * wait for each other when their rows share a stripe, and the renderer
+     * copies each row under its lock, so it never prints half an update.
+     * The widest cell of each column is kept with an atomic max, so layout()
+     * doesn't have to look at the stored rows at all.
+     *
+     * After this, addRow(), setRow(), setCell() and upsertRow() may be called
+     * from any thread while one thread renders with print(), printRange(),
+     * layout() and printLine(), or lines().  Rows added by other threads
+     * show up at the next layout().  Nothing else (sorting, filtering, the
+     * exports or the column aggregates) may run alongside the writers.
+     *
+     * Column widths never shrink, and a cell changed after layout() may be
+     * wider than its column until the next one.
+     *
+     * Can't be used with setSortedInsert(), enableExpiry() or enableChangeFeed().
+     *
+     * vt.enableConcurrentUpdates<0>(hosts.size());
+     * // On each host's thread
+     * vt.upsertRow(host.name, host.load);
+     *
+     * @tparam Key The column upsertRow() finds rows by
+     * @param capacity How many rows to make room for: growing past it briefly stops every reader and writer
+     * @param stripes How many locks to spread the rows over
+     */
+    template <std::size_t Key = 0>
+    void enableConcurrentUpdates(size_t capacity = 0, size_t stripes = 64)
+    {
+        assert(!_sort_less && !_expiry_enabled && !_feed_capacity && !_concurrent && !_tree_enabled && _views.empty() &&
+            stripes > 0);
+
+        _data.reserve(capacity);
+        _concurrent.reset(new ConcurrentState(_num_columns, stripes));
+        _concurrent->keys.reset(new StripedRowIndex<Key>(stripes));
+
+        for (size_t r = 0; r < _data.size(); r++)
+        {
+            raise_widths(_data[r]);
+            _concurrent->keys->insert(_data[r], r);
+        }
+
+        _concurrent->rows.store(_data.size(), std::memory_order_release);
+        _concurrent->visible = _data.size();
+    }
+
+    /**
+     * Change the row with this key, or add it if there isn't one
+     *
+     * Safe to call from any thread once enableConcurrentUpdates() has been
+     * called.  Only rows added by upsertRow() (or before enabling) are found
+     * by their key.  C string keys are remembered by pointer, so must
+     * outlive the table.
+     *
+     * @return The row's index
+     */
+    size_t upsertRow(Ts... entries)
+    {
+        assert(_concurrent);
+
+        return _concurrent->keys->upsert(*this, std::make_tuple(entries...));
+    }
+
+    /**
+     * Show the rows as a tree, with each row under its parent
+     *
+     * The first column is indented with ASCII tree glyphs.  Rows with
+     * hidden children (collapsed, or below the levels shown) are marked
+     * with a '+'.  Only the visible rows are sized and printed, and working
+     * out which rows are visible only visits those rows, so a big tree
+     * collapsed to a few rows prints as fast as a few rows.
+     *
+     * The rows that are printed (and counted by size()) are the visible
+     * ones, in tree order, but setRow(), setCell() and setCollapsed() take
+     * the index returned when the row was added.  column() and the
+     * aggregates cover every row, visible or not.  Rows already in the table
+     * become top level rows, as do rows added with addRow().
+     *
+     * Can't be used with setSortedInsert(), enableExpiry(), enableChangeFeed()
+     * or enableConcurrentUpdates().
+     *
+     * vt.enableTree();
+     * auto main = vt.addRootRow("main", 100.0);
+     * auto parse = vt.addChildRow(main, "parse", 60.0);
+     * vt.addChildRow(parse, "lex", 25.0);
+     * vt.setCollapsed(parse);
+     */
+    void enableTree()
+    {
+        assert(!_sort_less && !_expiry_enabled && !_feed_capacity && !_concurrent && !_tree_enabled);
+
+        _tree_enabled = true;
+        _tree_dirty = true;
+        _version++;
+
+        for (size_t slot = 0; slot < _data.size(); slot++)
+            link_node(no_node());
+    }
+
+    /**
+     * Add a top level row to the tree
+     *
+     * @return The row's index, to add children to it
+     */
+    size_t addRootRow(Ts... entries)
+    {
+        assert(_tree_enabled);
+
+        return store_row(std::make_tuple(entries...));
+    }
+
+    /**
+     * Add a row under another one, after the rows already under it
+     *
+     * @param parent The index of the parent row
+     * @return The row's index
+     */
+    size_t addChildRow(size_t parent, Ts... entries)
+    {
+        assert(_tree_enabled && parent < _data.size());
+        _version++;
+
+        auto row = std::make_tuple(entries...);
+        if (!_views.empty())
+            update_views(row);
+
+        return add_node(parent, std::move(row));
+    }
+
+    /**
+     * Hide (or show again) the rows under a row
+     *
+     * @param row The row's index
+     */
+    void setCollapsed(size_t row, bool collapsed = true)
+    {
+        assert(_tree_enabled && row < _data.size());
+
+        if (_tree_nodes[row].collapsed != collapsed)
+        {
+            _tree_nodes[row].collapsed = collapsed;
+            _tree_dirty = true;
+            _version++;
+        }
+    }
+
+    /**
+     * Whether the rows under a row are hidden
+     */
+    bool isCollapsed(size_t row) const { return _tree_nodes[row].collapsed; }
+
+    /**
+     * Only show the top levels of the tree
+     *
+     * @param levels How many levels to show: 1 for just the top level rows, 0 for all of them
+     */
+    void setTreeLevels(size_t levels)
+    {
+        assert(_tree_enabled);
+
+        _tree_levels = levels;
+        _tree_dirty = true;
+        _version++;
+    }
+
+    /**
+     * Record every change to the stored rows in a ring buffer
+     *
+     * Subscribers each keep a cursor and read the changes since it with
+     * readChanges(), at their own pace.  One that falls more than capacity
+     * changes behind is told to start again from changeSnapshot().
+     *
+     * Bound rows aren't recorded: they change on every print.
+     * Can't be used with setSortedInsert().
+     *
+     * Calling it again changes the capacity: the newest changes that fit
+     * are kept, so cursors stay valid (or are told they're behind).
+     *
+     * @param capacity The number of changes kept
+     */
+    void enableChangeFeed(size_t capacity)
+    {
+        assert(!_sort_less && !_concurrent && !_tree_enabled && capacity > 0);
+
+        // Move the changes that fit into a ring of the new size, each where its sequence number puts it
+        std::vector<VarTableChange<DataTuple>> feed(capacity);
+        const uint64_t first = std::max(oldest_change(), _feed_next - std::min<uint64_t>(_feed_next, capacity));
+        for (uint64_t sequence = first; sequence < _feed_next; sequence++)
+            feed[sequence % capacity] = std::move(_feed[sequence % _feed_capacity]);
+
+        _feed.swap(feed);
+        _feed_capacity = capacity;
+        _feed_first = first;
+    }
+
+    /**
+     * Copy the stored rows, as a starting point for reading changes
+     *
+     * @param rows Filled with each row's index (or slot) and values
+     * @return The cursor to read the changes made after the snapshot from
+     */
+    uint64_t changeSnapshot(std::vector<std::pair<size_t, DataTuple>>& rows) const
+    {
+        rows.clear();
+
+        for (size_t slot = 0; slot < _data.size(); slot++)
+            if (!_expiry_enabled || _alive[slot])
+                rows.emplace_back(slot, _data[slot]);
+
+        return _feed_next;
+    }
+
+    /**
+     * Read the changes made since a cursor
+     *
+     * @param cursor Where the last read got up to: moved past the changes read
+     * @param changes Filled with the changes, oldest first
+     * @param max_changes The most changes to read at once
+     */
+    VarTableFeedStatus readChanges(uint64_t& cursor,
+        std::vector<VarTableChange<DataTuple>>& changes,
+        size_t max_changes = static_cast<size_t>(-1)) const
+    {
+        changes.clear();
+
+        if (cursor < oldest_change())
+            return VarTableFeedStatus::BEHIND;
+
+        for (; cursor < _feed_next && changes.size() < max_changes; cursor++)
+            changes.push_back(_feed[cursor % _feed_capacity]);
+
+        return VarTableFeedStatus::OK;
+    }
+
+    /**
+     * Whether a slot holds a row that hasn't expired
+     */
+    bool rowAlive(size_t slot) const { return slot < _alive.size() && _alive[slot]; }
+
+    /**
+     * Whether a row hasn't expired (and its slot hasn't gone to another row)
+     */
+    bool rowAlive(VarTableRowHandle row) const { return rowAlive(row.slot) && _generations[row.slot] == row.generation; }
+
+    /**
+     * Remove the rows that have expired
+     *
+     * @param now The current time
+     * @return The number of rows removed
+     */
+    size_t expire(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now())
+    {
+        assert(_expiry_enabled);
+
+        if (now < _expiry_epoch)
+            return 0;
+
+        uint64_t tick = (now - _expiry_epoch) / _expiry_resolution;
+
+        return _expiry_wheel.advance(tick, [this](size_t slot) { release_slot(slot); });
+    }
+
+    /**
+     * Keep the rows sorted by a column as they are added
+     *
+     * Rows are kept in a list of sorted blocks, so addRow() is a binary search plus
+     * a move within one block, and printing walks the blocks in order without ever
+     * sorting.  Rows with equal keys stay in the order they were added.  NaN
+     * keys go last whichever way the rows are sorted, and null C strings first.
+     *
+     * Rows already in the table are sorted when this is called.
+     *
+     * vt.setSortedInsert<1>(false); // Highest score first
+     *
+     * @param ascending Whether the smallest key comes first
+     */
+    template <std::size_t I>
+    void setSortedInsert(bool ascending = true)
+    {
+        assert(!_expiry_enabled && !_feed_capacity && !_concurrent && !_tree_enabled);
+
+        // Gather up all the rows (in case the order is being changed)
+        for (auto& chunk : _chunks)
+            for (auto& row : chunk)
+                _data.emplace_back(std::move(row));
+
+        _chunks.clear();
+        _sort_less = ascending ? &VarTable::less_by<I> : &VarTable::greater_by<I>;
+
+        std::stable_sort(_data.begin(), _data.end(), _sort_less);
+
+        // Then split them into blocks
+        for (size_t first = 0; first < _data.size(); first += _chunk_rows)
+        {
+            auto last = std::min(first + _chunk_rows, _data.size());
+            _chunks.emplace_back(std::make_move_iterator(_data.begin() + first),
+                std::make_move_iterator(_data.begin() + last), _data.get_allocator());
+        }
+
+        _sorted_size = _data.size();
+        _chunk_starts.clear();
+        _data.clear();
+        _version++;
+    }
+
+    /**
+     * Remove rows that are exact duplicates of an earlier row
+     *
+     * The first of each set of duplicates is kept, and the rows stay in their
+     * original order.  Big tables are hashed and deduplicated in parallel.
+     *
+     * @return The number of rows removed
+     */
+    size_t distinct() { return distinct_by(typename VarTableMakeIndexList<sizeof...(Ts)>::type()); }
+
+    /**
+     * Remove rows whose values in the given columns match an earlier row
+     *
+     * vt.distinctBy<0, 2>(); // One row per name and age
+     *
+     * @return The number of rows removed
+     */
+    template <std::size_t... I>
+    size_t distinctBy()
+    {
+        return distinct_by(VarTableIndexList<I...>());
+    }
+
+    /**
+     * A read-only view of one column of the stored rows
+     *
+     * The rows are stored whole, so a column is strided: the view is a few runs
+     * of consecutive rows and reads the column straight out of them, without
+     * gathering it into a copy first.  It's invalidated by adding or removing rows.
+     */
+    template <std::size_t I>
+    class ColumnView
+    {
+    public:
+        typedef typename std::tuple_element<I, DataTuple>::type value_type;
+
+        /**
+         * A run of consecutive rows
+         */
+        struct Run
+        {
+            const DataTuple* rows;
+            size_t count;
+        };
+
+        /**
+         * The number of values
+         */
+        size_t size() const { return _size; }
+
+        /**
+         * The i-th value
+         */
+        const value_type& operator[](size_t i) const
+        {
+            assert(i < _size);
+
+            size_t run = 0;
+            if (_runs.size() > 1)
+                run = std::upper_bound(_starts.begin(), _starts.end(), i) - _starts.begin() - 1;
+
+            return std::get<I>(_runs[run].rows[i - _starts[run]]);
+        }
+
+        /**
+         * The runs of rows the values are in, in order
+         */
+        const std::vector<Run>& runs() const { return _runs; }
+
+        /**
+         * Call f(rows, count) for each run of rows from value first up to value last
+         */
+        template <class Function>
+        void forEachRun(size_t first, size_t last, Function& f) const
+        {
+            size_t run = 0;
+            if (_runs.size() > 1)
+                run = std::upper_bound(_starts.begin(), _starts.end(), first) - _starts.begin() - 1;
+
+            for (; first < last; run++)
+            {
+                auto offset = first - _starts[run];
+                auto count = std::min(_runs[run].count - offset, last - first);
+
+                f(_runs[run].rows + offset, count);
+                first += count;
+            }
+        }
+
+    protected:
+        friend class VarTable;
+
+        ColumnView() : _size(0) {}
+
+        void add(const DataTuple* rows, size_t count)
+        {
+            if (count == 0)
+                return;
+
+            Run run = { rows, count };
+            _runs.push_back(run);
+            _starts.push_back(_size);
+            _size += count;
+        }
+
+        /// The runs of rows
+        std::vector<Run> _runs;
+
+        /// Which value each run starts at
+        std::vector<size_t> _starts;
+
+        /// The number of values
+        size_t _size;
+    };
+
+    /**
+     * A view of one column of the stored rows (not bound rows)
+     *
+     * For a tree that's every row, including the hidden ones, and so it is
+     * for the aggregates (sum(), mean(), histogram() ...) that use it.
+     *
+     * auto counts = vt.column<1>();
+     * for (size_t i = 0; i < counts.size(); i++) ...
+     */
+    template <std::size_t I>
+    ColumnView<I> column() const
+    {
+        before_read();
+
+        ColumnView<I> view;
+
+        if (_expiry_enabled)
+        {
+            // Runs of live slots
+            for (size_t slot = 0; slot < _data.size();)
+            {
+                auto first = slot;
+                while (slot < _data.size() && _alive[slot])
+                    slot++;
+
+                view.add(_data.data() + first, slot - first);
+                slot++;
+            }
+        }
+        else if (_sort_less)
+        {
+            for (auto& chunk : _chunks)
+                view.add(chunk.data(), chunk.size());
+        }
+        else
+            view.add(_data.data(), _data.size());
+
+        return view;
+    }
+
+    /**
+     * The sum of a numeric column of the stored rows
+     *
+     * Integers are summed as 64 bit integers and floating point numbers as
+     * doubles (or long doubles).  Big tables are summed in parallel.
+     */
+    template <std::size_t I>
+    typename VarTableAccumulator<typename std::tuple_element<I, DataTuple>::type>::type sum() const
+    {
+        typedef typename VarTableAccumulator<typename std::tuple_element<I, DataTuple>::type>::type Sum;
+
+        std::vector<SumKernel<I, Sum>> kernels;
+        reduce_column(column<I>(), kernels);
+
+        Sum total = 0;
+        for (auto& kernel : kernels)
+            total += kernel.sum;
+
+        return total;
+    }
+
+    /**
+     * The mean of a numeric column of the stored rows (NaN if there aren't any)
+     */
+    template <std::size_t I>
+    double mean() const
+    {
+        auto rows = column<I>().size();
+        return rows ? static_cast<double>(sum<I>()) / rows : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    /**
+     * The smallest value in a column of the stored rows (there must be some)
+     *
+     * C strings are compared by their contents and NaN is skipped (NaN only
+     * if there's nothing else).
+     */
+    template <std::size_t I>
+    typename std::tuple_element<I, DataTuple>::type min() const
+    {
+        return extreme<I>(ValueLess());
+    }
+
+    /**
+     * The largest value in a column of the stored rows (there must be some)
+     *
+     * Compared the same way as min().
+     */
+    template <std::size_t I>
+    typename std::tuple_element<I, DataTuple>::type max() const
+    {
+        return extreme<I>(ValueGreater());
+    }
+
+    /**
+     * The number of stored rows whose value in a column passes a test
+     *
+     * size_t busy = vt.countIf<2>([](double load) { return load > 0.9; });
+     *
+     * @param predicate Called with each value: must be safe to call from several threads at once
+     */
+    template <std::size_t I, class Predicate>
+    size_t countIf(Predicate predicate) const
+    {
+        std::vector<CountKernel<I, Predicate>> kernels;
+        reduce_column(column<I>(), kernels, predicate);
+
+        size_t count = 0;
+        for (auto& kernel : kernels)
+            count += kernel.count;
+
+        return count;
+    }
+
+    /**
+     * Count the values of a numeric column of the stored rows in equal width buckets
+     *
+     * The buckets run from the smallest finite value to the largest: infinities
+     * are counted in the buckets outside them.
+     *
+     * vt.histogram<2>(10).print(std::cout);
+     *
+     * @param bins The number of buckets
+     * @return A table of each bucket, its count and its percentage of the values counted (empty if none are finite)
+     */
+    template <std::size_t I>
+    VarTable<std::string, uint64_t, double> histogram(size_t bins) const
+    {
+        assert(bins > 0);
+
+        std::vector<RangeKernel<I>> ranges;
+        reduce_column(column<I>(), ranges);
+
+        double low = std::numeric_limits<double>::infinity(), high = -low;
+        for (auto& range : ranges)
+        {
+            low = std::min(low, range.low);
+            high = std::max(high, range.high);
+        }
+
+        if (low > high)
+            return histogram_table(std::vector<double>(), std::vector<uint64_t>());
+
+        if (high <= low)
+            high = low + 1;
+
+        std::vector<double> edges(bins + 1);
+        for (size_t b = 0; b <= bins; b++)
+            edges[b] = low + (high - low) * b / bins;
+        edges[bins] = high;
+
+        return histogram<I>(edges, true);
+    }
+
+    /**
+     * Count the values of a numeric column of the stored rows in the given buckets
+     *
+     * Bucket b holds edges[b] <= value < edges[b + 1], and the last bucket
+     * includes its upper edge.  Values outside the edges are counted in extra
+     * buckets before and after, which are only shown if they aren't empty.
+     * NaN isn't counted, so the percentages are of the other values.
+     *
+     * @param edges The edges of the buckets, in ascending order
+     */
+    template <std::size_t I>
+    VarTable<std::string, uint64_t, double> histogram(const std::vector<double>& edges) const
+    {
+        return histogram<I>(edges, false);
+    }
+
+    /// The table materialize<K, V>() keeps: the key, then the count, sum, mean, min and max of column V
+    template <std::size_t K, std::size_t V>
+    using GroupTable = VarTable<typename std::tuple_element<K, DataTuple>::type,
+        uint64_t,
+        typename VarTableAccumulator<typename std::tuple_element<V, DataTuple>::type>::type,
+        double,
+        typename std::tuple_element<V, DataTuple>::type,
+        typename std::tuple_element<V, DataTuple>::type>;
+
+    /**
+     * A summary of a numeric column for each key of another column, kept up to date as rows are added
+     *
+     * Rows added to this table are folded into the summary as they're added,
+     * so printing it only costs as much as the summary, however big this
+     * table is.  Any other change to the rows (setRow(), setCell(), removing
+     * or expiring rows) has the summary worked out again from all the rows
+     * the next time it's printed or read (its size(), column() and the
+     * aggregates over it).
+     *
+     * The summary belongs to this table, which must not be moved while the
+     * summary is in use.  Keys are in the order they were first seen.
+     *
+     * auto& regions = vt.materialize<0, 2>();
+     * auto& busy = vt.materialize<0, 2>([](const decltype(vt)::DataTuple& row) { return std::get<3>(row) > 0.9; });
+     * vt.addRow("eu-west", "web1", 120, 0.95);
+     * regions.print(std::cout);
+     *
+     * @tparam K The column to group by
+     * @tparam V The numeric column to summarize
+     * @param filter Which rows to include (all of them if empty)
+     */
+    template <std::size_t K, std::size_t V>
+    GroupTable<K, V>& materialize(std::function<bool(const DataTuple&)> filter = nullptr)
+    {
+        static_assert(std::is_arithmetic<typename std::tuple_element<V, DataTuple>::type>::value,
+            "Only numeric columns can be summarized");
+        assert(!_concurrent);
+
+        auto view = new GroupView<K, V>(*this, std::move(filter));
+        _views.emplace_back(view);
+        view->rebuild();
+
+        return view->table;
+    }
+
+    /**
+     * A running total of a numeric column (see window)
+     */
+    template <std::size_t I>
+    struct CumSum
+    {
+        typedef typename VarTableAccumulator<typename std::tuple_element<I, DataTuple>::type>::type type;
+
+        struct State
+        {
+            State() : total(0) {}
+
+            type total;
+        };
+
+        type next(State& state, const DataTuple& row) const { return state.total += std::get<I>(row); }
+
+        std::string header;
+    };
+
+    /**
+     * The change in a numeric column since the row before (see window)
+     *
+     * 0 for the first row.
+     */
+    template <std::size_t I>
+    struct Delta
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type T;
+        typedef typename std::conditional<std::is_floating_point<T>::value, T, int64_t>::type type;
+
+        struct State
+        {
+            State() : seen(false), last() {}
+
+            bool seen;
+            T last;
+        };
+
+        type next(State& state, const DataTuple& row) const
+        {
+            type delta = state.seen ? static_cast<type>(std::get<I>(row)) - static_cast<type>(state.last) : 0;
+            state.last = std::get<I>(row);
+            state.seen = true;
+
+            return delta;
+        }
+
+        std::string header;
+    };
+
+    /**
+     * The value of a column n rows before (see window)
+     *
+     * A default value (0 or empty, "" for C strings) until there have been n rows.
+     */
+    template <std::size_t I>
+    struct Lag
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type type;
+
+        /// The last n values, oldest at next once it's full
+        struct State
+        {
+            State() : next(0) {}
+
+            std::vector<type> values;
+            size_t next;
+        };
+
+        type next(State& state, const DataTuple& row) const
+        {
+            type lagged = state.values.size() == n ? state.values[state.next] : blank(static_cast<type*>(nullptr));
+
+            if (state.values.size() < n)
+                state.values.push_back(std::get<I>(row));
+            else
+                state.values[state.next] = std::get<I>(row);
+            state.next = (state.next + 1) % n;
+
+            return lagged;
+        }
+
+        size_t n;
+        std::string header;
+
+    protected:
+        template <class T>
+        static T blank(T*) { return T(); }
+
+        // A null C string would break the stream it's printed to
+        static const char* blank(const char**) { return ""; }
+    };
+
+    /**
+     * The rank of each row, counting from 1 (see window)
+     *
+     * Rows with the same value of the column as the row before share its
+     * rank, and the rank after them skips ahead (1, 2, 2, 4).  With the rows
+     * in order of the column (see windowSorted) that's the SQL RANK().
+     */
+    template <std::size_t I>
+    struct Rank
+    {
+        typedef uint64_t type;
+
+        struct State
+        {
+            State() : count(0), rank(0), last() {}
+
+            uint64_t count;
+            uint64_t rank;
+            typename std::tuple_element<I, DataTuple>::type last;
+        };
+
+        type next(State& state, const DataTuple& row) const
+        {
+            if (state.count == 0 || !VarTableEqual()(std::get<I>(row), state.last))
+            {
+                state.rank = state.count + 1;
+                state.last = std::get<I>(row);
+            }
+            state.count++;
+
+            return state.rank;
+        }
+
+        std::string header;
+    };
+
+    /**
+     * A running total of column I, for window()
+     *
+     * @param header The column's header (cumsum(<header of I>) if empty)
+     */
+    template <std::size_t I>
+    CumSum<I> cumsum(std::string header = "") const
+    {
+        return CumSum<I>{ header.empty() ? "cumsum(" + _headers[I] + ")" : header };
+    }
+
+    /**
+     * The change in column I since the row before, for window()
+     */
+    template <std::size_t I>
+    Delta<I> delta(std::string header = "") const
+    {
+        return Delta<I>{ header.empty() ? "delta(" + _headers[I] + ")" : header };
+    }
+
+    /**
+     * The value of column I n rows before, for window()
+     */
+    template <std::size_t I>
+    Lag<I> lag(size_t n = 1, std::string header = "") const
+    {
+        assert(n > 0);
+
+        return Lag<I>{ n, header.empty() ? "lag(" + _headers[I] + ")" : header };
+    }
+
+    /**
+     * The rank of each row by column I, for window()
+     */
+    template <std::size_t I>
+    Rank<I> rank(std::string header = "") const
+    {
+        return Rank<I>{ header.empty() ? "rank(" + _headers[I] + ")" : header };
+    }
+
+    /**
+     * A copy of the stored rows with window functions added as columns
+     *
+     * Each function is worked out over the rows with the same value of column
+     * P (the partition), in a single pass over the rows in their usual order.
+     * Each partition keeps only the state its functions need: a running total,
+     * the last value, or the last n values for lag().
+     *
+     * auto report = vt.window<0>(vt.cumsum<2>(), vt.delta<2>(), vt.lag<2>(7));
+     * report.print(std::cout);
+     *
+     * @tparam P The partition column
+     * @param functions Made by cumsum(), delta(), lag() and rank()
+     */
+    template <std::size_t P, class... Functions>
+    VarTable<Ts..., typename Functions::type...> window(const Functions&... functions) const
+    {
+        std::vector<const DataTuple*> rows;
+        stored_rows(rows);
+
+        return window_table<P>(rows, typename VarTableMakeIndexList<sizeof...(Functions)>::type(), functions...);
+    }
+
+    /**
+     * Like window(), with the rows in order of column O (ties keep their usual order)
+     *
+     * auto ranked = vt.windowSorted<0, 2>(vt.rank<2>());
+     */
+    template <std::size_t P, std::size_t O, class... Functions>
+    VarTable<Ts..., typename Functions::type...> windowSorted(const Functions&... functions) const
+    {
+        std::vector<const DataTuple*> rows;
+        stored_rows(rows);
+        std::stable_sort(rows.begin(), rows.end(),
+            [](const DataTuple* a, const DataTuple* b) { return less_by<O>(*a, *b); });
+
+        return window_table<P>(rows, typename VarTableMakeIndexList<sizeof...(Functions)>::type(), functions...);
+    }
+
+    /**
+     * Add a row that is bound to live values
+     *
+     * Each cell is registered once and read every time the table is printed,
+     * so counters kept in std::atomic can be printed without copying them into
+     * the table first.  Bound rows are printed after the ordinary rows.
+     *
+     * vt.bindRow("requests", requests_counter, [&]() { return rate(); });
+     *
+     * @param cells A value, an atomic or a callback for each column
+     */
+    void bindRow(VarTableBinding<Ts>... cells)
+    {
+        _bindings.emplace_back(std::move(cells)...);
+        _version++;
+    }
+
+    /**
+     * Drop rows whose key has been seen before with a Bloom filter
+     *
+     * Memory stays fixed no matter how many rows are offered to addRowUnique(),
+     * at the cost of new keys occasionally (at about false_positive_rate) being
+     * mistaken for ones already seen.
+     *
+     * @param expected_keys How many distinct keys are expected
+     * @param false_positive_rate How often a new key may be wrongly dropped
+     */
+    template <std::size_t I>
+    void setUniqueFilter(size_t expected_keys, double false_positive_rate = 0.01)
+    {
+        _unique_filter.reset(new BloomRowFilter<I>(expected_keys, false_positive_rate));
+    }
+
+    /**
+     * Drop rows whose key has been seen before, remembering every key
+     *
+     * Never drops a new key, but memory grows with the number of distinct keys.
+     * C string keys are remembered by pointer, so must outlive the table.
+     */
+    template <std::size_t I>
+    void setUniqueFilterExact()
+    {
+        _unique_filter.reset(new ExactRowFilter<I>());
+    }
+
+    /**
+     * Add a row unless its key has been seen before
+     *
+     * setUniqueFilter() or setUniqueFilterExact() must have been called.
+     * Only rows offered to addRowUnique() are remembered.
+     *
+     * @return Whether the row was added
+     */
+    bool addRowUnique(Ts... entries)
+    {
+        assert(_unique_filter);
+
+        auto row = std::make_tuple(entries...);
+        if (!_unique_filter->insert(row))
+            return false;
+
+        store_row(std::move(row));
+
+        return true;
+    }
+
+    /**
+     * Pretty print the table of data
+     */
+    template <typename StreamType>
+    void print(StreamType& stream)
+    {
+        layout();
+
+        for (size_t line = 0; line < lineCount(); line++)
+        {
+            printLine(stream, line);
+            stream << "\n";
+        }
+    }
+
+    /**
+     * Pretty print some of the rows of the table
+     *
+     * The columns are sized to fit just those rows, so printing a page of a
+     * big table only costs as much as the page.
+     *
+     * @param first The first row to print
+     * @param count How many rows to print
+     */
+    template <typename StreamType>
+    void printRange(StreamType& stream, size_t first, size_t count)
+    {
+        snapshot_bindings();
+        clamp_range(first, count);
+
+        _column_sizes.resize(_num_columns);
+        size_columns(first, first + count);
+
+        for (size_t line = 0; line < top_lines(); line++)
+        {
+            printLine(stream, line);
+            stream << "\n";
+        }
+
+        for (size_t r = first; r < first + count; r++)
+        {
+            print_row(stream, r);
+            stream << "\n";
+
+            if (_print_style == PrintStyle::FULL)
+            {
+                print_plus(stream);
+                stream << "\n";
+            }
+        }
+
+        if (bottom_lines())
+        {
+            print_plus(stream);
+            stream << "\n";
+        }
+    }
+
+    /**
+     * Print the table (or some of its rows) as JSON
+     *
+     * {"columns": [...], "total": <rows in the table>, "offset": <first>, "rows": [[...], ...]}
+     *
+     * @param first The first row to print
+     * @param count How many rows to print
+     */
+    template <typename StreamType>
+    void printJSON(StreamType& stream, size_t first = 0, size_t count = static_cast<size_t>(-1))
+    {
+        snapshot_bindings();
+        clamp_range(first, count);
+
+        stream << "{\"columns\":[";
+        for (unsigned int i = 0; i < _num_columns; i++)
+        {
+            if (i)
+                stream << ",";
+            write_json_string(stream, _headers[i].data(), _headers[i].size());
+        }
+
+        stream << "],\"total\":" << num_rows() << ",\"offset\":" << first << ",\"rows\":[";
+
+        JsonCellWriter<StreamType> writer = { this, stream };
+        for (size_t r = first; r < first + count; r++)
+        {
+            stream << (r == first ? "\n[" : ",\n[");
+            visit_each(row_at(r), writer);
+            stream << "]";
+        }
+
+        stream << "]}\n";
+    }
+
+    /**
+     * Print the table (or some of its rows) as an HTML table
+     *
+     * @param first The first row to print
+     * @param count How many rows to print
+     */
+    template <typename StreamType>
+    void printHTML(StreamType& stream, size_t first = 0, size_t count = static_cast<size_t>(-1))
+    {
+        snapshot_bindings();
+        clamp_range(first, count);
+
+        stream << "<table>\n<thead><tr>";
+        for (auto& header : _headers)
+        {
+            stream << "<th>";
+            write_html_string(stream, header.data(), header.size());
+            stream << "</th>";
+        }
+        stream << "</tr></thead>\n<tbody>\n";
+
+        HtmlCellWriter<StreamType> writer = { this, stream };
+        for (size_t r = first; r < first + count; r++)
+        {
+            stream << "<tr>";
+            visit_each(row_at(r), writer);
+            stream << "</tr>\n";
+        }
+
+        stream << "</tbody>\n</table>\n";
+    }
+
+    /**
+     * Write the table as SQL: a CREATE TABLE and batched multi-row INSERTs
+     *
+     * The column types come from the table's types: integers (and bools) are
+     * INTEGER, floating point numbers are REAL and everything else is TEXT.
+     * Everything is written in a single transaction.  NaN and infinity are
+     * written as NULL.
+     *
+     * std::ofstream dump("hosts.sql");
+     * vt.exportSQL(dump, "hosts"); // sqlite3 hosts.db < hosts.sql
+     *
+     * @param stream Where to write the SQL
+     * @param table_name The name of the table to create
+     * @param batch_rows The most rows in each INSERT
+     */
+    template <typename StreamType>
+    void exportSQL(StreamType& stream, const std::string& table_name, size_t batch_rows = 500)
+    {
+        assert(batch_rows > 0);
+
+        snapshot_bindings();
+
+        // Quote the identifiers once, up front
+        std::vector<std::string> types;
+        column_sql_types(types, std::integral_constant<size_t, 0>());
+
+        auto quoted_table = sql_identifier(table_name);
+        std::string insert = "INSERT INTO " + quoted_table + " (";
+        stream << "BEGIN TRANSACTION;\nCREATE TABLE " << quoted_table << " (";
+
+        for (unsigned int i = 0; i < _num_columns; i++)
+        {
+            auto column = sql_identifier(_headers[i]);
+            insert += (i ? "," : "") + column;
+            stream << (i ? ", " : "") << column << " " << types[i];
+        }
+
+        insert += ") VALUES\n";
+        stream << ");\n";
+
+        // Numbers are written with enough digits to read back exactly
+        auto old_precision = stream.precision(std::numeric_limits<double>::max_digits10);
+
+        SqlCellWriter<StreamType> writer = { stream };
+        for (size_t r = 0; r < num_rows(); r++)
+        {
+            stream << (r % batch_rows == 0 ? insert : std::string(",\n")) << "(";
+            visit_each(row_at(r), writer);
+            stream << ")";
+
+            if (r % batch_rows == batch_rows - 1 || r + 1 == num_rows())
+                stream << ";\n";
+        }
+
+        stream.precision(old_precision);
+        stream << "COMMIT;\n";
+    }
+
+    /**
+     * Write the table as an Apache Arrow IPC stream
+     *
+     * The stream has a schema (the headers, with a type for each column) and
+     * then the rows in record batches, so pyarrow, DuckDB, polars etc. can read
+     * the table without parsing text.  Integers, floating point numbers and bools
+     * keep their types (long double is written as double) and everything else is
+     * written as UTF-8 text of however it prints.  Nothing is null.
+     *
+     * std::ofstream out("hosts.arrows", std::ios::binary);
+     * vt.exportArrowIPC(out); // pyarrow.ipc.open_stream("hosts.arrows").read_all()
+     *
+     * @param stream Where to write the stream (opened in binary mode)
+     * @param batch_rows The most rows in each record batch
+     */
+    template <typename StreamType>
+    void exportArrowIPC(StreamType& stream, size_t batch_rows = 65536)
+    {
+        assert(batch_rows > 0);
+
+        snapshot_bindings();
+
+        // The schema
+        VarTableFlatBuilder builder;
+        std::vector<size_t> slots, schema_slots;
+        auto header = start_arrow_message(builder, 1, 0);
+
+        auto schema = builder.table({ VarTableFlatBuilder::offset(1) }, schema_slots);
+        builder.patch(header, schema);
+
+        size_t first_field;
+        builder.patch(schema_slots[1], builder.offsets(_num_columns, first_field));
+        arrow_fields(builder, first_field, std::integral_constant<size_t, 0>());
+
+        write_arrow_message(stream, builder);
+
+        // The record batches: the columns are gathered from the rows a batch at a time
+        std::vector<ArrowColumn> columns(_num_columns);
+        for (size_t first = 0; first < num_rows(); first += batch_rows)
+        {
+            auto count = std::min(batch_rows, num_rows() - first);
+
+            for (auto& column : columns)
+            {
+                column.data.clear();
+                column.offsets.assign(1, 0);
+            }
+
+            ArrowCellWriter writer = { columns, 0 };
+            for (writer.row = 0; writer.row < count; writer.row++)
+                visit_each(row_at(first + writer.row), writer);
+
+            // Each column has an (empty) validity buffer, then its offsets if it has any, then its data
+            std::vector<int64_t> nodes, buffers;
+            int64_t body_length = 0;
+            for (auto& column : columns)
+            {
+                nodes.push_back(static_cast<int64_t>(count));
+                nodes.push_back(0);
+
+                buffers.push_back(body_length);
+                buffers.push_back(0);
+
+                if (column.offsets.size() > 1)
+                    add_arrow_buffer(buffers, body_length, column.offsets.size() * sizeof(int32_t));
+
+                add_arrow_buffer(buffers, body_length, column.data.size());
+            }
+
+            header = start_arrow_message(builder, 3, body_length);
+
+            auto batch = builder.table({ VarTableFlatBuilder::scalar(0, 8, count),
+                VarTableFlatBuilder::offset(1),
+                VarTableFlatBuilder::offset(2) }, slots);
+            builder.patch(header, batch);
+            builder.patch(slots[1], builder.structs(nodes.data(), nodes.size() / 2, 16));
+            builder.patch(slots[2], builder.structs(buffers.data(), buffers.size() / 2, 16));
+
+            write_arrow_message(stream, builder);
+
+            static const char padding[8] = {};
+            for (auto& column : columns)
+            {
+                if (column.offsets.size() > 1)
+                {
+                    auto size = column.offsets.size() * sizeof(int32_t);
+                    stream.write(reinterpret_cast<const char*>(column.offsets.data()), size);
+                    stream.write(padding, (8 - size % 8) % 8);
+                }
+
+                stream.write(column.data.data(), column.data.size());
+                stream.write(padding, (8 - column.data.size() % 8) % 8);
+            }
+        }
+
+        // The end of the stream
+        const uint32_t end[2] = { 0xFFFFFFFF, 0 };
+        stream.write(reinterpret_cast<const char*>(end), sizeof(end));
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * Append the rows added since the last export to a file
+     *
+     * Only stored rows are exported (not bound rows), and the table is treated
+     * as append-only: rows already exported aren't written again, even if they
+     * have changed.  A program that rebuilds its table after a restart carries
+     * on from the rows it hadn't exported yet.
+     *
+     * Can't be used with setSortedInsert() or enableExpiry(), which move rows.
+     *
+     * In a BINARY file the header is the number of columns (uint32) then for each
+     * column its kind ('i' signed, 'u' unsigned, 'f' floating point, 'b' bool,
+     * 's' string), its size in bytes (uint8) and its name (uint32 size then the
+     * characters).  Numbers and bools are stored as they are in memory and
+     * strings as their uint32 size then their characters.
+     *
+     * VarTableAppendFile file;
+     * file.open("hosts.csv", VarTableFileFormat::CSV);
+     * vt.exportAppend(file); // every minute
+     *
+     * @param file An open file
+     * @param batch_rows The most rows written at a time (and in each BINARY block)
+     * @return false if writing failed or the table has fewer rows than have been exported
+     */
+    bool exportAppend(VarTableAppendFile& file, size_t batch_rows = 65536)
+    {
+        assert(file.isOpen() && batch_rows > 0 && !_sort_less && !_expiry_enabled && !_tree_enabled);
+
+        if (num_stored() < file.rows())
+            return false;
+
+        if (num_stored() == file.rows())
+            return true;
+
+        std::string header, data;
+        VarTableStringBuf buffer(data);
+        std::ostream stream(&buffer);
+        stream.precision(std::numeric_limits<double>::max_digits10);
+
+        if (file.format() == VarTableFileFormat::CSV)
+        {
+            CsvCellWriter writer = { stream };
+            for (unsigned int i = 0; i < _num_columns; i++)
+                writer(i, _headers[i]);
+            stream << "\n";
+
+            header.swap(data);
+        }
+        else
+        {
+            BinaryCellWriter writer = { data };
+            writer.put(static_cast<uint32_t>(_num_columns));
+            binary_columns(writer, std::integral_constant<size_t, 0>());
+
+            header.swap(data);
+        }
+
+        for (size_t first = static_cast<size_t>(file.rows()); first < num_stored(); first += batch_rows)
+        {
+            auto last = std::min(first + batch_rows, num_stored());
+
+            data.clear();
+            if (file.format() == VarTableFileFormat::CSV)
+            {
+                CsvCellWriter writer = { stream };
+                for (size_t r = first; r < last; r++)
+                {
+                    visit_each(stored_at(r), writer);
+                    stream << "\n";
+                }
+            }
+            else
+            {
+                BinaryCellWriter writer = { data };
+                for (size_t r = first; r < last; r++)
+                    visit_each(stored_at(r), writer);
+            }
+
+            if (!file.append(header, data, last - first))
+                return false;
+        }
+
+        return file.commit();
+    }
+#endif
+
+    /**
+     * Where the rows are allocated from
+     */
+    VarTableMemoryResource* memoryResource() const { return _data.get_allocator().resource(); }
+
+    /**
+     * Run the parallel operations (sortExternal(), distinct(), the column aggregates) on an executor
+     *
+     * vt.setExecutor(&my_pool);
+     * VarTableInlineExecutor inline_executor;
+     * vt.setExecutor(&inline_executor);   // Everything on the calling thread
+     *
+     * @param executor Must outlive the table (nullptr to go back to the default)
+     */
+    void setExecutor(VarTableExecutor* executor) { _executor = executor; }
+
+    /**
+     * Where the parallel operations run (nullptr for VarTableExecutor::defaultExecutor())
+     */
+    VarTableExecutor* executor() const { return _executor; }
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * Visit the stored rows sorted by a column, using no more than a fixed amount of memory
+     *
+     * The table itself isn't touched.  Each row's key and index are sorted in
+     * runs that fit in the budget (several runs at once for big tables),
+     * spilled to temporary files in the binary format of exportAppend(), then
+     * merged, handing each row to the sink as soon as it's known to be next.
+     * If every run fits in the budget at once they're merged in memory and
+     * nothing is spilled.
+     * Rows with equal keys are visited in the order they're stored, and rows
+     * with a NaN key come last whichever way the rows are sorted.
+     *
+     * vt.sortExternal<1>("/tmp", 64 << 20, [&](const decltype(vt)::DataTuple& row) { ... });
+     *
+     * The column must be numbers or text.
+     *
+     * @param tmpdir Where to put the temporary files (they are deleted as soon as they are made)
+     * @param memory_budget The most memory to use, in bytes
+     * @param sink Called with each row, in order
+     * @param ascending Whether the smallest key comes first
+     * @return false if the temporary files couldn't be made, written or read
+     */
+    template <std::size_t I, class Sink>
+    bool sortExternal(const std::string& tmpdir, size_t memory_budget, Sink&& sink, bool ascending = true)
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type T;
+        static_assert(std::is_arithmetic<T>::value || VarTableIsText<T>::value,
+            "Only columns of numbers or text can be sorted externally");
+
+        typedef typename std::conditional<std::is_arithmetic<T>::value, T, std::string>::type Key;
+
+        index_rows();
+        const size_t n = num_stored();
+
+        // Sort runs in parallel, each worker with its share of the budget (no fewer than 4KB each)
+        const size_t min_run_budget = 4096;
+        const unsigned int workers = static_cast<unsigned int>(
+            std::max<size_t>(1, std::min<size_t>(num_workers(n), memory_budget / min_run_budget)));
+        const size_t run_budget = memory_budget / workers;
+
+        // A worker's last run is kept in memory rather than spilled, in case nothing needs spilling
+        std::vector<std::vector<SortRecord<Key>>> worker_records(workers);
+        std::vector<std::vector<SpillFile>> worker_runs(workers);
+        std::vector<char> failed(workers, 0);
+
+        parallel_for(workers, [&](unsigned int w) {
+            auto& records = worker_records[w];
+            size_t key_bytes = 0, chunk = 0;
+
+            for (size_t r = n * w / workers, end = n * (w + 1) / workers; r < end || !records.empty();)
+            {
+                if (r < end)
+                {
+                    SortRecord<Key> record = { Key(), r };
+                    set_sort_key(record.key, std::get<I>(stored_at(r, chunk)));
+
+                    // The records' room counts too, as it will be if adding one makes it grow (by at most double)
+                    size_t room = records.size() < records.capacity() ? records.capacity()
+                                                                      : std::max<size_t>(2 * records.capacity(), 1);
+                    size_t used = room * sizeof(record) + key_bytes + sort_key_size(record.key);
+
+                    if (records.empty() || used <= run_budget)
+                    {
+                        key_bytes += sort_key_size(record.key);
+                        records.push_back(std::move(record));
+                        r++;
+                        continue;
+                    }
+                }
+
+                std::sort(records.begin(), records.end(), SortRecordLess<Key>(ascending));
+
+                if (r == end && worker_runs[w].empty())
+                    return;
+
+                worker_runs[w].emplace_back();
+                if (!spill_run(tmpdir, records, worker_runs[w].back()))
+                {
+                    failed[w] = 1;
+                    return;
+                }
+
+                records.clear();
+                key_bytes = 0;
+            }
+        });
+
+        bool spilled = false;
+        for (unsigned int w = 0; w < workers; w++)
+        {
+            if (failed[w])
+                return false;
+
+            spilled = spilled || !worker_runs[w].empty();
+        }
+
+        // Everything fit: merge the workers' runs straight from memory
+        if (!spilled)
+        {
+            std::vector<size_t> next(workers, 0);
+            SortRecordLess<Key> less(ascending);
+
+            for (;;)
+            {
+                int best = -1;
+                for (unsigned int w = 0; w < workers; w++)
+                    if (next[w] < worker_records[w].size() &&
+                        (best < 0 || less(worker_records[w][next[w]], worker_records[best][next[best]])))
+                        best = w;
+
+                if (best < 0)
+                    return true;
+
+                sink(stored_at(static_cast<size_t>(worker_records[best][next[best]++].row)));
+            }
+        }
+
+        std::vector<SpillFile> runs;
+        for (unsigned int w = 0; w < workers; w++)
+        {
+            // The runs that were kept in memory go to disk with the rest
+            if (!worker_records[w].empty())
+            {
+                worker_runs[w].emplace_back();
+                if (!spill_run(tmpdir, worker_records[w], worker_runs[w].back()))
+                    return false;
+            }
+
+            std::vector<SortRecord<Key>>().swap(worker_records[w]);
+
+            for (auto& run : worker_runs[w])
+                runs.push_back(std::move(run));
+        }
+
+        // Merge as many runs at a time as the budget has room to read from
+        const size_t min_read_buffer = 64 << 10;
+        const size_t fan_in = std::max<size_t>(memory_budget / min_read_buffer, 2);
+
+        while (runs.size() > fan_in)
+        {
+            std::vector<SpillFile> merged;
+            for (size_t first = 0; first < runs.size(); first += fan_in)
+            {
+                auto last = std::min(first + fan_in, runs.size());
+
+                merged.emplace_back();
+                std::vector<SortRecord<Key>> records;
+                std::string buffer;
+
+                bool ok = open_spill(tmpdir, merged.back()) &&
+                    merge_runs<Key>(runs, first, last, memory_budget, ascending, [&](const SortRecord<Key>& record) {
+                        encode_sort_record(buffer, record);
+                        return buffer.size() < min_read_buffer || flush_spill(merged.back(), buffer);
+                    }) &&
+                    flush_spill(merged.back(), buffer);
+
+                if (!ok)
+                    return false;
+            }
+
+            runs.swap(merged);
+        }
+
+        return merge_runs<Key>(runs, 0, runs.size(), memory_budget, ascending, [&](const SortRecord<Key>& record) {
+            sink(stored_at(static_cast<size_t>(record.row)));
+            return true;
+        });
+    }
+
+    /**
+     * Pretty print the table sorted by a column, using no more than a fixed amount of memory
+     *
+     * See sortExternal().  Bound rows are printed after the sorted rows, as
+     * usual, and the sorted rows aren't colored by color rules.
+     */
+    template <std::size_t I, typename StreamType>
+    bool printSortedExternal(StreamType& stream, const std::string& tmpdir, size_t memory_budget, bool ascending = true)
+    {
+        layout();
+
+        for (size_t line = 0; line < top_lines(); line++)
+        {
+            printLine(stream, line);
+            stream << "\n";
+        }
+
+        _row_styles = nullptr;
+        _row_prefix_size = 0;
+        bool sorted = sortExternal<I>(tmpdir, memory_budget, [&](const DataTuple& row) {
+            print_separator(stream);
+            print_each(row, stream);
+            stream << "\n";
+
+            if (lines_per_row() > 1)
+            {
+                print_plus(stream);
+                stream << "\n";
+            }
+        }, ascending);
+
+        if (!sorted)
+            return false;
+
+        for (size_t line = top_lines() + num_stored() * lines_per_row(); line < lineCount(); line++)
+        {
+            printLine(stream, line);
+            stream << "\n";
+        }
+
+        return true;
+    }
+#endif
+
+    /**
+     * The number of rows in the table (including bound rows)
+     */
+    size_t size() const
+    {
+        before_read();
+        return num_stored() + _bindings.size();
+    }
+
+    /**
+     * A number that changes whenever the stored rows or the formatting change
+     *
+     * Output rendered at the same version is the same, unless the table has
+     * bound rows: those can change on every render.
+     */
+    uint64_t version() const
+    {
+        return _version + (_concurrent ? _concurrent->updates.load(std::memory_order_relaxed) : 0);
+    }
+
+    /**
+     * Whether the table has rows bound to live values (see bindRow)
+     */
+    bool hasBoundRows() const { return !_bindings.empty(); }
+
+    /**
+     * Snapshot the bound rows and find the width of every column
+     *
+     * print() does this itself: call it directly only when rendering with printLine()
+     */
+    void layout()
+    {
+        snapshot_bindings();
+        size_columns();
+    }
+
+    /**
+     * The width of each column as of the last layout()
+     */
+    const std::vector<unsigned int>& columnSizes() const { return _column_sizes; }
+
+    /**
+     * Make columns at least this wide
+     *
+     * Used to line up the columns of several tables (see TableGroup).
+     * Takes effect immediately, without another layout().
+     *
+     * @param minimum_sizes The minimum width of each column: may be shorter than the number of columns
+     */
+    void setMinimumColumnSizes(const std::vector<unsigned int>& minimum_sizes)
+    {
+        _minimum_column_sizes = minimum_sizes;
+        _version++;
+
+        for (unsigned int i = 0; i < _column_sizes.size() && i < _minimum_column_sizes.size(); i++)
+            _column_sizes[i] = std::max(_column_sizes[i], _minimum_column_sizes[i]);
+    }
+
+    /**
+     * The number of characters in every printed line (as of the last layout())
+     */
+    size_t width() const
+    {
+        // We will have _num_columns + 1 "|" characters
+        size_t total_width = _num_columns + 1;
+
+        // Now add in the size of each colum
+        for (auto& col_size : _column_sizes)
+            total_width += col_size + (2 * _cell_padding);
+
+        return total_width;
+    }
+
+    /**
+     * The number of lines print() will write (as of the last layout())
+     */
+    size_t lineCount() const
+    {
+        return top_lines() + num_rows() * lines_per_row() + bottom_lines();
+    }
+
+    /**
+     * Print a single line of the table, without the newline
+     *
+     * layout() must have been called first
+     *
+     * @param line Which line: from 0 to lineCount() - 1
+     */
+    template <typename StreamType>
+    void printLine(StreamType& stream, size_t line)
+    {
+        assert(line < lineCount());
+
+        // The top line, the headers and the line below them
+        if (line < top_lines())
+        {
+            if (has_top_border())
+            {
+                if (line == 0)
+                    return print_plus(stream);
+                line--;
+            }
+
+            if (line == 0)
+                return print_header(stream);
+
+            return print_plus(stream);
+        }
+
+        line -= top_lines();
+
+        // The rows of the table (each followed by a line in the FULL style)
+        if (line < num_rows() * lines_per_row())
+        {
+            if (line % lines_per_row() == 0)
+                return print_row(stream, line / lines_per_row());
+
+            return print_plus(stream);
+        }
+
+        // The bottom line
+        print_plus(stream);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * Write as much of the table as a (non-blocking) file descriptor will take
+     *
+     * Returns AGAIN when the descriptor would block: call it again with the same
+     * cursor once the descriptor is writable and it carries on where it stopped.
+     * The cursor is all the state a write needs, so many clients can each be
+     * streamed the same table from one event loop.
+     *
+     * A cursor starting at the beginning lays the table out if it has changed,
+     * or always if it has bound rows so that their values are current.  Each
+     * cursor writes the layout it started with, even if the table is printed
+     * in between.  A cursor part way through when the table changes, or when a
+     * new layout is made for bound rows, gets CHANGED rather than a torn table.
+     *
+     * SIGPIPE should be ignored when writing to sockets or pipes.
+     *
+     * @param fd The file descriptor to write to
+     * @param cursor Where the last call got up to
+     */
+    VarTableWriteStatus writeTo(int fd, VarTableCursor& cursor)
+    {
+        if (cursor.line == 0 && cursor.offset == 0)
+        {
+            if (_write_layout == 0 || _write_version != version() || hasBoundRows())
+            {
+                layout();
+
+                _write_snapshot = _snapshot;
+                _write_column_sizes = _column_sizes;
+                _write_version = version();
+                _write_layout++;
+            }
+
+            cursor.layout = _write_layout;
+        }
+        else if (cursor.layout != _write_layout || _write_version != version())
+            return VarTableWriteStatus::CHANGED;
+
+        // Render the layout the cursor started with, whatever has been printed since
+        _snapshot.swap(_write_snapshot);
+        _column_sizes.swap(_write_column_sizes);
+
+        auto status = write_lines(fd, cursor);
+
+        _snapshot.swap(_write_snapshot);
+        _column_sizes.swap(_write_column_sizes);
+
+        return status;
+    }
+#endif
+
+    /**
+     * Iterates over the rendered lines of a table (see lines())
+     */
+    class LineIterator
+    {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::string value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::string* pointer;
+        typedef const std::string& reference;
+
+        LineIterator(VarTable* table, size_t line) : _table(table), _line(line) {}
+
+        /**
+         * The line, without the newline: valid until another line is rendered
+         */
+        const std::string& operator*() const { return _table->render_line(_line); }
+        const std::string* operator->() const { return &_table->render_line(_line); }
+
+        LineIterator& operator++()
+        {
+            _line++;
+            return *this;
+        }
+
+        LineIterator operator++(int)
+        {
+            auto old = *this;
+            _line++;
+            return old;
+        }
+
+        bool operator==(const LineIterator& other) const { return _line == other._line; }
+        bool operator!=(const LineIterator& other) const { return _line != other._line; }
+
+    protected:
+        VarTable* _table;
+        size_t _line;
+    };
+
+    /**
+     * The rendered lines of a table, for range-based for
+     */
+    class Lines
+    {
+    public:
+        Lines(VarTable* table) : _table(table) {}
+
+        LineIterator begin() const { return LineIterator(_table, 0); }
+        LineIterator end() const { return LineIterator(_table, _table->lineCount()); }
+
+        /// The number of lines
+        size_t size() const { return _table->lineCount(); }
+
+    protected:
+        VarTable* _table;
+    };
+
+    /**
+     * The lines print() would write, each rendered only when it's reached
+     *
+     * Each line is rendered into the same buffer, so memory use doesn't grow
+     * with the table, and stopping early skips the rest of the rows.  The table
+     * is laid out when this is called and mustn't change while iterating.
+     *
+     * for (const std::string& line : vt.lines())
+     *     widget.addLine(line);
+     */
+    Lines lines()
+    {
+        layout();
+        _line_buffer_line = std::numeric_limits<size_t>::max();
+
+        return Lines(this);
+    }
+
+    /**
+     * Set how to format numbers for each column
+     *
+     * Note: this is ignored for std::string columns
+     *
+     * @column_format The format for each column: MUST be the same length as the number of columns.
+     */
+    void setColumnFormat(const std::vector<VarTableColumnFormat>& column_format)
+    {
+        assert(column_format.size() == std::tuple_size<DataTuple>::value);
+
+        _column_format = column_format;
+        _version++;
+
+        if (_expiry_enabled)
+            rebuild_width_histogram();
+    }
+
+    /**
+     * Color the cells of a numeric column that match a rule
+     *
+     * Rules are compiled into a lookup from value to color, and cells are
+     * matched a column at a time for blocks of rows when printing.  The colors
+     * are written as ANSI escape codes around the cell, so don't affect the
+     * width of the columns.  When rules overlap the first one added wins.
+     *
+     * Rules on non-numeric columns never match.
+     *
+     * @param column The column to color
+     * @param rule The values to color, and the color
+     */
+    void addColorRule(size_t column, const VarTableColorRule& rule)
+    {
+        assert(column < _num_columns);
+
+        _color_rules.resize(_num_columns);
+        _color_rules[column].push_back(rule);
+        compile_color_rules();
+    }
+
+    /**
+     * Remove all of the color rules
+     */
+    void clearColorRules()
+    {
+        _color_rules.clear();
+        compile_color_rules();
+    }
+
+    /**
+     * Set print style
+     */
+    void setPrintStyle(const PrintStyle& print_style)
+    {
+        _print_style = print_style;
+        _version++;
+    }
+
+    /**
+     * Set alignment style
+     */
+    void setAlignmentStyle(const std::vector<AlignmentStyle>& alignment_style)
+    {
+        assert(alignment_style.size() == std::tuple_size<DataTuple>::value);
+
+        _alignment_style = alignment_style;
+        _version++;
+    }
+
+    /**
+     * Set how many digits of precision to show for floating point numbers
+     *
+     * Note: this is ignored for std::string columns
+     *
+     * @column_format The precision for each column: MUST be the same length as the number of columns.
+     */
+    void setColumnPrecision(const std::vector<int>& precision)
+    {
+        assert(precision.size() == std::tuple_size<DataTuple>::value);
+        _precision = precision;
+        _version++;
+    }
+
+protected:
+    // Just some handy typedefs for the following two functions
+    typedef decltype(&std::right) align_type;
+
+    // Attempts to figure out the alignment style
+    static align_type justify(AlignmentStyle align)
+    {
+        if (align == AlignmentStyle::LEFT)
+            return std::left;
+        else if (align == AlignmentStyle::RIGHT)
+            return std::right;
+        else
+            return std::internal;
+    }
+
+    // Attempts to figure out the correct justification for the data
+    // If it's a floating point value
+    template <typename T,
+        typename = typename std::enable_if<
+        std::is_arithmetic<typename std::remove_reference<T>::type>::value>::type>
+        static align_type justify_empty(int /*firstchoice*/)
+    {
+        return std::right;
+    }
+
+    // Otherwise
+    template <typename T>
+    static align_type justify_empty(long /*secondchoice*/)
+    {
+        return std::left;
+    }
+
+    /**
+     * These three functions print out each item in a Tuple into the table
+     *
+     * Original Idea From From https://stackoverflow.com/a/26908596
+     *
+     * BTW: This would all be a lot easier with generic lambdas
+     * there would only need to be one of this sequence and then
+     * you could pass in a generic lambda.  Unfortunately, that's C++14
+     */
+
+     /**
+      *  This ends the recursion
+      */
+    template <typename TupleType, typename StreamType>
+    void print_each(TupleType&&,
+        StreamType& /*stream*/,
+        std::integral_constant<
+        size_t,
+        std::tuple_size<typename std::remove_reference<TupleType>::type>::value>)
+    {
+    }
+
+    /**
+     * This gets called on each item
+     */
+    template <std::size_t I,
+        typename TupleType,
+        typename StreamType,
+        typename = typename std::enable_if<
+        I != std::tuple_size<typename std::remove_reference<TupleType>::type>::value>::type>
+        void print_each(TupleType&& t, StreamType& stream, std::integral_constant<size_t, I>)
+    {
+        auto& val = std::get<I>(t);
+
+        set_format(stream, I);
+
+        // The color goes outside the width so it doesn't count towards it
+        auto style = _row_styles ? _row_styles[I] : 0;
+
+        stream << std::string(_cell_padding, ' ');
+
+        // The tree glyphs go in front of the first cell, inside its width
+        auto width = _column_sizes[I];
+        if (I == 0 && _row_prefix_size)
+        {
+            stream.write(_row_prefix, _row_prefix_size);
+            width -= _row_prefix_size;
+        }
+
+        if (style)
+            stream << _style_codes[style];
+
+        stream << std::setw(width);
+        if (!_alignment_style.empty())
+            stream << justify(_alignment_style[I]);
+        else
+            stream << justify_empty<decltype(val)>(0);
+        stream << val;
+
+        if (style)
+            stream << "\033[0m";
+        stream << std::string(_cell_padding, ' ');
+
+        if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
+            stream << "|";
+        else
+            stream << " ";
+
+        unset_format(stream);
+
+        // Recursive call to print the next item
+        print_each(std::forward<TupleType>(t), stream, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * Set the precision and format of a column on the stream
+     */
+    template <typename StreamType>
+    void set_format(StreamType& stream, size_t column)
+    {
+        // Set the precision
+        if (!_precision.empty())
+        {
+            assert(_precision.size() == std::tuple_size<DataTuple>::value);
+
+            stream << std::setprecision(_precision[column]);
+        }
+
+        // Set the format
+        if (!_column_format.empty())
+        {
+            assert(_column_format.size() == std::tuple_size<DataTuple>::value);
+
+            if (_column_format[column] == VarTableColumnFormat::SCIENTIFIC)
+                stream << std::scientific;
+
+            if (_column_format[column] == VarTableColumnFormat::FIXED)
+                stream << std::fixed;
+
+            if (_column_format[column] == VarTableColumnFormat::PERCENT)
+                stream << std::fixed << std::setprecision(2);
+        }
+    }
+
+    /**
+     * Undo set_format()
+     */
+    template <typename StreamType>
+    void unset_format(StreamType& stream)
+    {
+        if (!_column_format.empty())
+        {
+            // Because "stream << std::defaultfloat;" won't compile with old GCC or Clang
+            stream.unsetf(std::ios_base::floatfield);
+        }
+    }
+
+    /**
+     * These three functions call visitor(column, value) for each item in a Tuple
+     */
+
+     /**
+      * End the recursion
+      */
+    template <typename Visitor>
+    void visit_each(const DataTuple&,
+        Visitor& /*visitor*/,
+        std::integral_constant<size_t, std::tuple_size<DataTuple>::value>)
+    {
+    }
+
+    /**
+     * Recursively called for each element
+     */
+    template <std::size_t I,
+        typename Visitor,
+        typename = typename std::enable_if<I != std::tuple_size<DataTuple>::value>::type>
+        void visit_each(const DataTuple& t, Visitor& visitor, std::integral_constant<size_t, I>)
+    {
+        visitor(I, std::get<I>(t));
+
+        visit_each(t, visitor, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * The function that is actually called that starts the recursion
+     */
+    template <typename Visitor>
+    void visit_each(const DataTuple& t, Visitor& visitor)
+    {
+        visit_each(t, visitor, std::integral_constant<size_t, 0>());
+    }
+
+    /**
+     * Write a string with the characters special to JSON escaped
+     */
+    template <typename StreamType>
+    static void write_json_string(StreamType& stream, const char* s, size_t size)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        stream << '"';
+        for (size_t i = 0; i < size; i++)
+        {
+            auto c = static_cast<unsigned char>(s[i]);
+            if (c == '"' || c == '\\')
+                stream << '\\' << s[i];
+            else if (c == '\n')
+                stream << "\\n";
+            else if (c < 0x20)
+                stream << "\\u00" << hex[c >> 4] << hex[c & 15];
+            else
+                stream << s[i];
+        }
+        stream << '"';
+    }
+
+    /**
+     * Write a string with the characters special to HTML escaped
+     */
+    template <typename StreamType>
+    static void write_html_string(StreamType& stream, const char* s, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            switch (s[i])
+            {
+            case '&': stream << "&amp;"; break;
+            case '<': stream << "&lt;"; break;
+            case '>': stream << "&gt;"; break;
+            case '"': stream << "&quot;"; break;
+            default: stream << s[i]; break;
+            }
+        }
+    }
+
+    /**
+     * Writes each cell of a row as a JSON value
+     */
+    template <typename StreamType>
+    struct JsonCellWriter
+    {
+        VarTable* table;
+        StreamType& stream;
+
+        /// Numbers are written as they would be printed (but NaN and infinity are null)
+        template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, T value)
+        {
+            if (column)
+                stream << ",";
+
+            if (std::is_same<T, bool>::value)
+                stream << (value ? "true" : "false");
+            else if (!std::isfinite(static_cast<double>(value)))
+                stream << "null";
+            else
+            {
+                table->set_format(stream, column);
+                stream << +value; // + so chars are written as numbers
+                table->unset_format(stream);
+            }
+        }
+
+        void operator()(size_t column, const std::string& value)
+        {
+            if (column)
+                stream << ",";
+            write_json_string(stream, value.data(), value.size());
+        }
+
+        void operator()(size_t column, const char* value)
+        {
+            if (column)
+                stream << ",";
+
+            if (!value)
+                stream << "null";
+            else
+                write_json_string(stream, value, std::strlen(value));
+        }
+
+        /// Anything else is written as a string of however it prints
+        template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, const T& value)
+        {
+            std::ostringstream text;
+            text << value;
+            operator()(column, text.str());
+        }
+    };
+
+    /**
+     * Writes each cell of a row as an SQL value
+     */
+    template <typename StreamType>
+    struct SqlCellWriter
+    {
+        StreamType& stream;
+
+        template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, T value)
+        {
+            if (column)
+                stream << ",";
+
+            if (std::is_floating_point<T>::value && !std::isfinite(static_cast<double>(value)))
+                stream << "NULL";
+            else
+                stream << +value; // + so chars are written as numbers
+        }
+
+        void operator()(size_t column, const std::string& value) { write(column, value.data(), value.size()); }
+
+        void operator()(size_t column, const char* value)
+        {
+            if (!value)
+                stream << (column ? ",NULL" : "NULL");
+            else
+                write(column, value, std::strlen(value));
+        }
+
+        template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, const T& value)
+        {
+            std::ostringstream text;
+            text << value;
+            operator()(column, text.str());
+        }
+
+        /**
+         * Write a string literal: only strings with quotes in them need escaping
+         */
+        void write(size_t column, const char* s, size_t size)
+        {
+            if (column)
+                stream << ",";
+
+            stream << "'";
+            if (!std::memchr(s, '\'', size))
+                stream.write(s, size);
+            else
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    if (s[i] == '\'')
+                        stream << "''";
+                    else
+                        stream << s[i];
+                }
+            }
+            stream << "'";
+        }
+    };
+
+    /**
+     * Quote an SQL identifier
+     */
+    static std::string sql_identifier(const std::string& name)
+    {
+        std::string quoted = "\"";
+        for (auto c : name)
+        {
+            if (c == '"')
+                quoted += '"';
+            quoted += c;
+        }
+
+        return quoted + "\"";
+    }
+
+    /**
+     * These two functions find the SQL type of each column
+     */
+    void column_sql_types(std::vector<std::string>&, std::integral_constant<size_t, std::tuple_size<DataTuple>::value>)
+    {
+    }
+
+    template <std::size_t I, typename = typename std::enable_if<I != std::tuple_size<DataTuple>::value>::type>
+    void column_sql_types(std::vector<std::string>& types, std::integral_constant<size_t, I>)
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type T;
+
+        types.push_back(std::is_integral<T>::value ? "INTEGER" :
+            std::is_floating_point<T>::value ? "REAL" : "TEXT");
+
+        column_sql_types(types, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * Writes each cell of a row as a CSV field
+     */
+    struct CsvCellWriter
+    {
+        std::ostream& stream;
+
+        template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, T value)
+        {
+            if (column)
+                stream << ",";
+
+            stream << +value; // + so chars are written as numbers
+        }
+
+        void operator()(size_t column, const std::string& value) { write(column, value.data(), value.size()); }
+
+        void operator()(size_t column, const char* value) { write(column, value ? value : "", value ? std::strlen(value) : 0); }
+
+        template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, const T& value)
+        {
+            std::ostringstream text;
+            text << value;
+            operator()(column, text.str());
+        }
+
+        /**
+         * Write a field: only fields with commas, quotes or line breaks in them are quoted
+         */
+        void write(size_t column, const char* s, size_t size)
+        {
+            if (column)
+                stream << ",";
+
+            bool quote = false;
+            for (size_t i = 0; i < size && !quote; i++)
+                quote = s[i] == ',' || s[i] == '"' || s[i] == '\n' || s[i] == '\r';
+
+            if (!quote)
+            {
+                stream.write(s, size);
+                return;
+            }
+
+            stream << "\"";
+            for (size_t i = 0; i < size; i++)
+            {
+                if (s[i] == '"')
+                    stream << "\"\"";
+                else
+                    stream << s[i];
+            }
+            stream << "\"";
+        }
+    };
+
+    /**
+     * Appends each cell of a row in the binary format of exportAppend()
+     */
+    struct BinaryCellWriter
+    {
+        std::string& data;
+
+        template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t, T value) { put(value); }
+
+        void operator()(size_t, const std::string& value) { write(value.data(), value.size()); }
+
+        void operator()(size_t, const char* value) { write(value ? value : "", value ? std::strlen(value) : 0); }
+
+        template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, const T& value)
+        {
+            std::ostringstream text;
+            text << value;
+            operator()(column, text.str());
+        }
+
+        template <class T>
+        void put(T value) { data.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+        void write(const char* s, size_t size)
+        {
+            put(static_cast<uint32_t>(size));
+            data.append(s, size);
+        }
+    };
+
+    /**
+     * These two functions write the kind, size and name of each column in the binary format
+     */
+    void binary_columns(BinaryCellWriter&, std::integral_constant<size_t, std::tuple_size<DataTuple>::value>)
+    {
+    }
+
+    template <std::size_t I, typename = typename std::enable_if<I != std::tuple_size<DataTuple>::value>::type>
+    void binary_columns(BinaryCellWriter& writer, std::integral_constant<size_t, I>)
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type T;
+
+        char kind = std::is_same<T, bool>::value ? 'b' : std::is_floating_point<T>::value ? 'f' :
+            std::is_integral<T>::value ? (std::is_signed<T>::value ? 'i' : 'u') : 's';
+
+        writer.put(kind);
+        writer.put(static_cast<uint8_t>(std::is_arithmetic<T>::value ? sizeof(T) : 0));
+        writer.write(_headers[I].data(), _headers[I].size());
+
+        binary_columns(writer, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * A column of a record batch being written as Arrow
+     */
+    struct ArrowColumn
+    {
+        /// The values (or the text, or the bits of bools)
+        std::vector<char> data;
+
+        /// Where each string starts in data, and where the last one ends
+        std::vector<int32_t> offsets;
+    };
+
+    /**
+     * Adds each cell of a row to its Arrow column
+     */
+    struct ArrowCellWriter
+    {
+        std::vector<ArrowColumn>& columns;
+        size_t row;
+
+        void operator()(size_t column, bool value)
+        {
+            auto& data = columns[column].data;
+            if (row % 8 == 0)
+                data.push_back('\0');
+
+            if (value)
+                data.back() |= static_cast<char>(1 << (row % 8));
+        }
+
+        template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, T value)
+        {
+            auto stored = static_cast<typename VarTableArrowTraits<T>::storage>(value);
+
+            auto& data = columns[column].data;
+            data.insert(data.end(), reinterpret_cast<const char*>(&stored),
+                reinterpret_cast<const char*>(&stored) + sizeof(stored));
+        }
+
+        void operator()(size_t column, const std::string& value) { write(column, value.data(), value.size()); }
+
+        void operator()(size_t column, const char* value) { write(column, value ? value : "", value ? std::strlen(value) : 0); }
+
+        template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, const T& value)
+        {
+            std::ostringstream text;
+            text << value;
+            operator()(column, text.str());
+        }
+
+        void write(size_t column, const char* s, size_t size)
+        {
+            auto& data = columns[column].data;
+            data.insert(data.end(), s, s + size);
+
+            assert(data.size() <= static_cast<size_t>(std::numeric_limits<int32_t>::max()));
+            columns[column].offsets.push_back(static_cast<int32_t>(data.size()));
+        }
+    };
+
+    /**
+     * Start an Arrow message: returns where to patch in the offset to its header
+     *
+     * @param header_type 1 for a Schema, 3 for a RecordBatch
+     * @param body_length The size of the buffers that follow the message
+     */
+    static size_t start_arrow_message(VarTableFlatBuilder& builder, unsigned char header_type, int64_t body_length)
+    {
+        std::vector<size_t> slots;
+
+        builder.clear();
+        auto message = builder.table({ VarTableFlatBuilder::scalar(0, 2, 4), // Version 5
+            VarTableFlatBuilder::scalar(1, 1, header_type),
+            VarTableFlatBuilder::offset(2),
+            VarTableFlatBuilder::scalar(3, 8, static_cast<uint64_t>(body_length)) }, slots);
+        builder.setRoot(message);
+
+        return slots[2];
+    }
+
+    /**
+     * Write a message: a continuation marker, its size, then the message padded to 8 bytes
+     */
+    template <typename StreamType>
+    static void write_arrow_message(StreamType& stream, VarTableFlatBuilder& builder)
+    {
+        builder.align(8);
+
+        const uint32_t prefix[2] = { 0xFFFFFFFF, static_cast<uint32_t>(builder.buffer().size()) };
+        stream.write(reinterpret_cast<const char*>(prefix), sizeof(prefix));
+        stream.write(builder.buffer().data(), builder.buffer().size());
+    }
+
+    /**
+     * Add a buffer to a record batch's body, padded to 8 bytes
+     */
+    static void add_arrow_buffer(std::vector<int64_t>& buffers, int64_t& body_length, size_t size)
+    {
+        buffers.push_back(body_length);
+        buffers.push_back(static_cast<int64_t>(size));
+
+        body_length += static_cast<int64_t>((size + 7) / 8 * 8);
+    }
+
+    /**
+     * These functions write the Arrow type of each column
+     */
+    static size_t arrow_type(VarTableFlatBuilder& builder, std::integral_constant<unsigned char, 2>, size_t bit_width, bool is_signed)
+    {
+        std::vector<size_t> slots;
+        return builder.table({ VarTableFlatBuilder::scalar(0, 4, bit_width),
+            VarTableFlatBuilder::scalar(1, 1, is_signed) }, slots);
+    }
+
+    static size_t arrow_type(VarTableFlatBuilder& builder, std::integral_constant<unsigned char, 3>, size_t bit_width, bool)
+    {
+        std::vector<size_t> slots;
+        return builder.table({ VarTableFlatBuilder::scalar(0, 2, bit_width == 32 ? 1 : 2) }, slots);
+    }
+
+    template <unsigned char Type>
+    static size_t arrow_type(VarTableFlatBuilder& builder, std::integral_constant<unsigned char, Type>, size_t, bool)
+    {
+        std::vector<size_t> slots;
+        return builder.table({}, slots);
+    }
+
+    void arrow_fields(VarTableFlatBuilder&, size_t, std::integral_constant<size_t, std::tuple_size<DataTuple>::value>)
+    {
+    }
+
+    template <std::size_t I, typename = typename std::enable_if<I != std::tuple_size<DataTuple>::value>::type>
+    void arrow_fields(VarTableFlatBuilder& builder, size_t slot, std::integral_constant<size_t, I>)
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type T;
+        const unsigned char type = VarTableArrowTraits<T>::type;
+
+        std::vector<size_t> slots;
+        auto field = builder.table({ VarTableFlatBuilder::offset(0),
+            VarTableFlatBuilder::scalar(1, 1, 0), // Not nullable
+            VarTableFlatBuilder::scalar(2, 1, type),
+            VarTableFlatBuilder::offset(3),
+            VarTableFlatBuilder::offset(5) }, slots);
+        builder.patch(slot, field);
+
+        builder.patch(slots[0], builder.string(_headers[I]));
+        builder.patch(slots[3], arrow_type(builder, std::integral_constant<unsigned char, type>(),
+            std::is_floating_point<T>::value && sizeof(T) == sizeof(float) ? 32 : 8 * sizeof(T),
+            std::is_signed<T>::value));
+
+        size_t no_children;
+        builder.patch(slots[5], builder.offsets(0, no_children));
+
+        arrow_fields(builder, slot + 4, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * Writes each cell of a row as an HTML table cell
+     */
+    template <typename StreamType>
+    struct HtmlCellWriter
+    {
+        VarTable* table;
+        StreamType& stream;
+
+        template <class T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, T value)
+        {
+            table->set_format(stream, column);
+            stream << "<td style=\"text-align:right\">" << value << "</td>";
+            table->unset_format(stream);
+        }
+
+        void operator()(size_t /*column*/, const std::string& value)
+        {
+            stream << "<td>";
+            write_html_string(stream, value.data(), value.size());
+            stream << "</td>";
+        }
+
+        void operator()(size_t /*column*/, const char* value)
+        {
+            stream << "<td>";
+            if (value)
+                write_html_string(stream, value, std::strlen(value));
+            stream << "</td>";
+        }
+
+        template <class T, typename std::enable_if<!std::is_arithmetic<T>::value, int>::type = 0>
+        void operator()(size_t column, const T& value)
+        {
+            std::ostringstream text;
+            text << value;
+            operator()(column, text.str());
+        }
+    };
+
+    /**
+     * Clamp a range of rows to the rows there are
+     */
+    void clamp_range(size_t& first, size_t& count) const
+    {
+        first = std::min(first, num_rows());
+        count = std::min(count, num_rows() - first);
+    }
+
+    /**
+     * his is what gets called first
+     */
+    template <typename TupleType, typename StreamType>
+    void print_each(TupleType&& t, StreamType& stream)
+    {
+        print_each(std::forward<TupleType>(t), stream, std::integral_constant<size_t, 0>());
+    }
+
+    /**
+     * Try to find the size the column will take up
+     *
      * If the datatype has a size() member... let's call it
      */
-    template <class T>
-    size_t sizeOfData(const T& data, decltype(((T*)nullptr)->size())* /*dummy*/ = nullptr)
+    template <class T>
+    size_t sizeOfData(const T& data, decltype(((T*)nullptr)->size())* /*dummy*/ = nullptr)
+    {
+        return data.size();
+    }
+
+    /**
+     * Try to find the size the column will take up
+     *
+     * If the datatype is an integer - let's get it's length
+     */
+    template <class T>
+    size_t sizeOfData(const T& data,
+        typename std::enable_if<std::is_integral<T>::value>::type* /*dummy*/ = nullptr)
+    {
+        if (data == 0)
+            return 1;
+
+        return std::log10(data) + 1;
+    }
+
+    /**
+     * If it doesn't... let's just use a statically set size
+     */
+    size_t sizeOfData(...) { return _static_column_size; }
+
+    /**
+     * These three functions iterate over the Tuple, find the printed size of each element and set it
+     * in a vector
+     */
+
+     /**
+      * End the recursion
+      */
+    template <typename TupleType>
+    void size_each(TupleType&&,
+        std::vector<unsigned int>& /*sizes*/,
+        std::integral_constant<
+        size_t,
+        std::tuple_size<typename std::remove_reference<TupleType>::type>::value>)
+    {
+    }
+
+    /**
+     * Recursively called for each element
+     */
+    template <std::size_t I,
+        typename TupleType,
+        typename = typename std::enable_if<
+        I != std::tuple_size<typename std::remove_reference<TupleType>::type>::value>::type>
+        void
+        size_each(TupleType&& t, std::vector<unsigned int>& sizes, std::integral_constant<size_t, I>)
+    {
+        sizes[I] = sizeOfData(std::get<I>(t));
+
+        // Override for Percent
+        if (!_column_format.empty())
+            if (_column_format[I] == VarTableColumnFormat::PERCENT)
+                sizes[I] = 6; // 100.00
+
+            // Continue the recursion
+        size_each(std::forward<TupleType>(t), sizes, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * The function that is actually called that starts the recursion
+     */
+    template <typename TupleType>
+    void size_each(TupleType&& t, std::vector<unsigned int>& sizes)
+    {
+        size_each(std::forward<TupleType>(t), sizes, std::integral_constant<size_t, 0>());
+    }
+
+    /**
+     * These three functions read each bound cell into the snapshot row
+     */
+
+     /**
+      * End the recursion
+      */
+    template <typename BindingTuple>
+    void load_each(const BindingTuple&,
+        DataTuple& /*row*/,
+        std::integral_constant<size_t, std::tuple_size<DataTuple>::value>)
+    {
+    }
+
+    /**
+     * Recursively called for each element
+     */
+    template <std::size_t I,
+        typename BindingTuple,
+        typename = typename std::enable_if<I != std::tuple_size<DataTuple>::value>::type>
+        void load_each(const BindingTuple& cells, DataTuple& row, std::integral_constant<size_t, I>)
+    {
+        std::get<I>(cells).load(std::get<I>(row));
+
+        load_each(cells, row, std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * The function that is actually called that starts the recursion
+     */
+    template <typename BindingTuple>
+    void load_each(const BindingTuple& cells, DataTuple& row)
+    {
+        load_each(cells, row, std::integral_constant<size_t, 0>());
+    }
+
+    /**
+     * Read every bound row into the snapshot buffer
+     *
+     * The buffer is reused between renders, so this does no allocation
+     * once it has grown to the number of bound rows.
+     */
+    void snapshot_bindings()
+    {
+        if (_before_render)
+            _before_render();
+
+        // The rows may have changed, so the colors need working out again
+        _style_block_rows = 0;
+
+        if (_concurrent)
+            _concurrent->visible = _concurrent->rows.load(std::memory_order_acquire);
+
+        _snapshot.resize(_bindings.size());
+
+        for (size_t r = 0; r < _bindings.size(); r++)
+            load_each(_bindings[r], _snapshot[r]);
+    }
+
+    /**
+     * Compare two values for sorting
+     */
+    template <class T>
+    static bool less_value(const T& a, const T& b)
+    {
+        return a < b;
+    }
+
+    /**
+     * C strings are compared by their contents, not their address (null comes first)
+     */
+    static bool less_value(const char* a, const char* b) { return b && (!a || std::strcmp(a, b) < 0); }
+
+    /**
+     * Compare values the way less_value() does, for min() and max()
+     */
+    struct ValueLess
+    {
+        template <class T>
+        bool operator()(const T& a, const T& b) const { return less_value(a, b); }
+    };
+
+    struct ValueGreater
+    {
+        template <class T>
+        bool operator()(const T& a, const T& b) const { return less_value(b, a); }
+    };
+
+    /**
+     * Whether a value is NaN (never, unless it's floating point)
+     */
+    template <class T>
+    static bool is_nan_value(const T&) { return false; }
+
+    static bool is_nan_value(float value) { return value != value; }
+    static bool is_nan_value(double value) { return value != value; }
+    static bool is_nan_value(long double value) { return value != value; }
+
+    /**
+     * Whether a sorts before b, with NaN last whichever way they're sorted
+     *
+     * NaN doesn't compare with anything, so without this it would break the order.
+     */
+    template <class T>
+    static bool sorts_before(const T& a, const T& b, bool ascending)
+    {
+        bool a_nan = is_nan_value(a), b_nan = is_nan_value(b);
+        if (a_nan || b_nan)
+            return !a_nan && b_nan;
+
+        return ascending ? less_value(a, b) : less_value(b, a);
+    }
+
+    /**
+     * Orders rows by column I, smallest first
+     */
+    template <std::size_t I>
+    static bool less_by(const DataTuple& a, const DataTuple& b)
+    {
+        return sorts_before(std::get<I>(a), std::get<I>(b), true);
+    }
+
+    /**
+     * Orders rows by column I, biggest first
+     */
+    template <std::size_t I>
+    static bool greater_by(const DataTuple& a, const DataTuple& b)
+    {
+        return sorts_before(std::get<I>(a), std::get<I>(b), false);
+    }
+
+    /**
+     * Put a row into the right place in the sorted blocks
+     */
+    void insert_sorted(DataTuple&& row)
+    {
+        if (_chunks.empty())
+            _chunks.emplace_back(_data.get_allocator());
+
+        // The first block whose last row comes after the new one (or the last block)
+        size_t lo = 0, hi = _chunks.size() - 1;
+        while (lo < hi)
+        {
+            auto mid = (lo + hi) / 2;
+            if (_sort_less(row, _chunks[mid].back()))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+
+        auto& chunk = _chunks[lo];
+        chunk.insert(std::upper_bound(chunk.begin(), chunk.end(), row, _sort_less), std::move(row));
+
+        // Split blocks that have grown too big
+        if (chunk.size() >= 2 * _chunk_rows)
+        {
+            RowVector upper(std::make_move_iterator(chunk.begin() + _chunk_rows),
+                std::make_move_iterator(chunk.end()), chunk.get_allocator());
+            chunk.resize(_chunk_rows);
+            _chunks.insert(_chunks.begin() + lo + 1, std::move(upper));
+        }
+
+        _sorted_size++;
+        _chunk_starts.clear();
+    }
+
+    /**
+     * Store a new row, wherever the storage mode puts it
+     *
+     * @return The slot the row is in (only meaningful when rows can expire)
+     */
+    size_t store_row(DataTuple&& row)
+    {
+        if (_concurrent)
+            return append_row(std::move(row));
+
+        _version++;
+
+        if (!_views.empty())
+            update_views(row);
+
+        if (_tree_enabled)
+            return add_node(no_node(), std::move(row));
+
+        if (_sort_less)
+        {
+            insert_sorted(std::move(row));
+            return 0;
+        }
+
+        if (!_expiry_enabled)
+        {
+            _data.emplace_back(std::move(row));
+
+            if (_feed_capacity)
+                record_change(VarTableChangeType::ROW_ADDED, _data.size() - 1, 0).values = _data.back();
+
+            return _data.size() - 1;
+        }
+
+        // Reuse the slot of an expired row if there is one
+        size_t slot;
+        if (!_free_slots.empty())
+        {
+            slot = _free_slots.back();
+            _free_slots.pop_back();
+            _data[slot] = std::move(row);
+            _alive[slot] = 1;
+        }
+        else
+        {
+            slot = _data.size();
+            _data.emplace_back(std::move(row));
+            _alive.push_back(1);
+            _generations.push_back(0);
+        }
+
+        size_each(_data[slot], _row_sizes);
+        _width_histogram.add(_row_sizes);
+        _live_rows_dirty = true;
+
+        if (_feed_capacity)
+            record_change(VarTableChangeType::ROW_ADDED, slot, 0).values = _data[slot];
+
+        return slot;
+    }
+
+    /**
+     * Remove the row in a slot, leaving the slot free for reuse
+     */
+    void release_slot(size_t slot)
+    {
+        _version++;
+        mark_views_stale();
+        _expiry_wheel.cancel(slot);
+
+        size_each(_data[slot], _row_sizes);
+        _width_histogram.remove(_row_sizes);
+
+        _alive[slot] = 0;
+        _generations[slot]++;
+        _free_slots.push_back(slot);
+        _live_rows_dirty = true;
+
+        if (_feed_capacity)
+            record_change(VarTableChangeType::ROW_REMOVED, slot, 0);
+    }
+
+    /**
+     * Replace every value of a stored row
+     *
+     * @param row The row's index (or its slot if rows can expire)
+     */
+    void replace_row(size_t row, DataTuple&& values)
+    {
+        _version++;
+        mark_views_stale();
+
+        if (_expiry_enabled)
+        {
+            size_each(_data[row], _row_sizes);
+            _width_histogram.remove(_row_sizes);
+        }
+
+        _data[row] = std::move(values);
+
+        if (_expiry_enabled)
+        {
+            size_each(_data[row], _row_sizes);
+            _width_histogram.add(_row_sizes);
+        }
+
+        if (_feed_capacity)
+            record_change(VarTableChangeType::ROW_CHANGED, row, 0).values = _data[row];
+    }
+
+    /**
+     * Add a change to the feed, overwriting the oldest once it's full
+     *
+     * @return The change, so the caller can fill in the values
+     */
+    VarTableChange<DataTuple>& record_change(VarTableChangeType type, size_t row, size_t column)
+    {
+        // Reuse the oldest entry (and its strings' capacity)
+        auto& change = _feed[_feed_next % _feed_capacity];
+        change.sequence = _feed_next++;
+        change.type = type;
+        change.row = row;
+        change.column = column;
+
+        return change;
+    }
+
+    /**
+     * The sequence number of the oldest change still in the ring
+     */
+    uint64_t oldest_change() const
+    {
+        return std::max(_feed_first, _feed_next - std::min<uint64_t>(_feed_next, _feed_capacity));
+    }
+
+    /**
+     * The tick a row added now with this ttl expires on
+     */
+    uint64_t expiry_tick(std::chrono::steady_clock::duration ttl) const
+    {
+        auto since_epoch = std::chrono::steady_clock::now() - _expiry_epoch + ttl;
+
+        // Round up: a row never expires early
+        return (since_epoch + _expiry_resolution - std::chrono::steady_clock::duration(1)) /
+            _expiry_resolution;
+    }
+
+    /**
+     * Count the width of every live row again (when the widths may have changed)
+     */
+    void rebuild_width_histogram()
+    {
+        _width_histogram.reset(_num_columns);
+        _row_sizes.resize(_num_columns);
+
+        for (size_t slot = 0; slot < _data.size(); slot++)
+        {
+            if (_alive[slot])
+            {
+                size_each(_data[slot], _row_sizes);
+                _width_histogram.add(_row_sizes);
+            }
+        }
+    }
+
+    /**
+     * The number of stored (not bound) rows
+     */
+    size_t num_stored() const
+    {
+        // Rows added by other threads are counted from the next layout()
+        if (_concurrent)
+            return _concurrent->visible;
+
+        if (_expiry_enabled)
+        {
+            index_rows();
+            return _live_rows.size();
+        }
+
+        if (_tree_enabled)
+        {
+            index_rows();
+            return _tree_visible.size();
+        }
+
+        return _sort_less ? _sorted_size : _data.size();
+    }
+
+    /**
+     * Let a materialized view catch up with its source before its rows are read
+     */
+    void before_read() const
+    {
+        if (_before_render)
+            _before_render();
+    }
+
+    /**
+     * Bring the index of the stored rows up to date
+     *
+     * For sorted rows that's where each block starts, for rows that can
+     * expire it's which slots hold live rows.
+     */
+    void index_rows() const
+    {
+        before_read();
+
+        if (_expiry_enabled && _live_rows_dirty)
+        {
+            _live_rows.clear();
+            for (size_t slot = 0; slot < _alive.size(); slot++)
+                if (_alive[slot])
+                    _live_rows.push_back(slot);
+
+            _live_rows_dirty = false;
+        }
+
+        if (_tree_enabled && _tree_dirty)
+            index_tree();
+
+        if (!_chunk_starts.empty() || _chunks.empty())
+            return;
+
+        size_t start = 0;
+        for (auto& chunk : _chunks)
+        {
+            _chunk_starts.push_back(start);
+            start += chunk.size();
+        }
+        _last_chunk = 0;
+    }
+
+    /**
+     * The r-th stored row
+     *
+     * When the rows are sorted, chunk is the block the last row was found in:
+     * rows are usually visited in order so it's checked first.  index_rows()
+     * must have been called.
+     */
+    const DataTuple& stored_at(size_t r, size_t& chunk) const
+    {
+        if (_expiry_enabled)
+            return _data[_live_rows[r]];
+
+        if (_tree_enabled)
+            return _data[_tree_visible[r]];
+
+        if (!_sort_less)
+            return _data[r];
+
+        if (r < _chunk_starts[chunk] || r - _chunk_starts[chunk] >= _chunks[chunk].size())
+        {
+            if (chunk + 1 < _chunks.size() && r >= _chunk_starts[chunk + 1] &&
+                r - _chunk_starts[chunk + 1] < _chunks[chunk + 1].size())
+                chunk++;
+            else
+                chunk = std::upper_bound(_chunk_starts.begin(), _chunk_starts.end(), r) -
+                _chunk_starts.begin() - 1;
+        }
+
+        return _chunks[chunk][r - _chunk_starts[chunk]];
+    }
+
+    /**
+     * The r-th stored row
+     */
+    const DataTuple& stored_at(size_t r) const
+    {
+        index_rows();
+        return stored_at(r, _last_chunk);
+    }
+
+    /**
+     * Remove the stored rows that aren't marked to keep, without changing the order of the rest
+     */
+    void remove_rows(const std::vector<char>& keep)
+    {
+        assert(!_concurrent && !_tree_enabled);
+        _version++;
+        mark_views_stale();
+
+        if (_expiry_enabled)
+        {
+            // Leave the slots of the other rows where they are
+            index_rows();
+            auto live_rows = _live_rows;
+
+            for (size_t r = 0; r < live_rows.size(); r++)
+                if (!keep[r])
+                    release_slot(live_rows[r]);
+
+            return;
+        }
+
+        if (!_sort_less)
+        {
+            // Removing the last rows first means each index is still right when it's applied
+            if (_feed_capacity)
+                for (size_t r = _data.size(); r-- > 0;)
+                    if (!keep[r])
+                        record_change(VarTableChangeType::ROW_REMOVED, r, 0);
+
+            size_t out = 0;
+            for (size_t r = 0; r < _data.size(); r++)
+            {
+                if (keep[r])
+                {
+                    if (out != r)
+                        _data[out] = std::move(_data[r]);
+                    out++;
+                }
+            }
+            _data.erase(_data.begin() + out, _data.end());
+            return;
+        }
+
+        size_t r = 0;
+        _sorted_size = 0;
+        for (auto& chunk : _chunks)
+        {
+            size_t out = 0;
+            for (size_t i = 0; i < chunk.size(); i++, r++)
+            {
+                if (keep[r])
+                {
+                    if (out != i)
+                        chunk[out] = std::move(chunk[i]);
+                    out++;
+                }
+            }
+            chunk.erase(chunk.begin() + out, chunk.end());
+            _sorted_size += out;
+        }
+
+        _chunks.erase(std::remove_if(_chunks.begin(), _chunks.end(),
+            [](const RowVector& chunk) { return chunk.empty(); }),
+            _chunks.end());
+        _chunk_starts.clear();
+    }
+
+    /**
+     * How many threads to split work over
+     *
+     * Small jobs aren't worth starting threads for.
+     *
+     * @param work The number of rows to be processed
+     */
+    unsigned int num_workers(size_t work) const
+    {
+        if (work < (1 << 16))
+            return 1;
+
+        return std::max(1u, executor_or_default()->concurrency());
+    }
+
+    /**
+     * Call task(0) ... task(tasks - 1) on the executor, and wait for them all
+     *
+     * A single task just runs on the calling thread.
+     */
+    void parallel_for(unsigned int tasks, const std::function<void(unsigned int)>& task) const
+    {
+        if (tasks == 1)
+            task(0);
+        else if (tasks > 1)
+            executor_or_default()->parallelFor(tasks, task);
+    }
+
+    /**
+     * The table's executor, starting the default pool if it has none
+     */
+    VarTableExecutor* executor_or_default() const
+    {
+        return _executor ? _executor : VarTableExecutor::defaultExecutor();
+    }
+
+    /**
+     * Reduce a column: one kernel per worker is called with the runs of rows in
+     * its share of the column, then the caller combines them
+     *
+     * @param args Passed to each kernel's constructor
+     */
+    template <std::size_t I, class Kernel, class... Args>
+    void reduce_column(const ColumnView<I>& view, std::vector<Kernel>& kernels, const Args&... args) const
+    {
+        const size_t n = view.size();
+        const unsigned int workers = num_workers(n);
+
+        kernels.clear();
+        for (unsigned int w = 0; w < workers; w++)
+            kernels.emplace_back(args...);
+
+        parallel_for(workers, [&](unsigned int w) {
+            view.forEachRun(n * w / workers, n * (w + 1) / workers, kernels[w]);
+        });
+    }
+
+    /**
+     * Sums runs of rows with four independent accumulators, so the additions overlap
+     */
+    template <std::size_t I, class Sum>
+    struct SumKernel
+    {
+        SumKernel() : sum(0) {}
+
+        void operator()(const DataTuple* rows, size_t count)
+        {
+            Sum s[4] = { 0, 0, 0, 0 };
+
+            size_t k = 0;
+            for (; k + 4 <= count; k += 4)
+            {
+                s[0] += std::get<I>(rows[k]);
+                s[1] += std::get<I>(rows[k + 1]);
+                s[2] += std::get<I>(rows[k + 2]);
+                s[3] += std::get<I>(rows[k + 3]);
+            }
+
+            for (; k < count; k++)
+                s[0] += std::get<I>(rows[k]);
+
+            sum += (s[0] + s[1]) + (s[2] + s[3]);
+        }
+
+        Sum sum;
+    };
+
+    /**
+     * Finds the first value in runs of rows that no other value comes before, skipping NaN
+     */
+    template <std::size_t I, class Compare>
+    struct ExtremeKernel
+    {
+        typedef typename std::tuple_element<I, DataTuple>::type T;
+
+        ExtremeKernel(const Compare& compare) : compare(compare), found(false) {}
+
+        void operator()(const DataTuple* rows, size_t count)
+        {
+            if (!found && count)
+            {
+                best = std::get<I>(rows[0]);
+                found = true;
+            }
+
+            for (size_t k = 0; k < count; k++)
+                if (better(std::get<I>(rows[k]), best))
+                    best = std::get<I>(rows[k]);
+        }
+
+        /**
+         * Whether a value should replace the best so far: anything beats NaN, and NaN beats nothing
+         */
+        bool better(const T& value, const T& best) const
+        {
+            return is_nan_value(best) ? !is_nan_value(value) : !is_nan_value(value) && compare(value, best);
+        }
+
+        Compare compare;
+        T best;
+        bool found;
+    };
+
+    template <std::size_t I, class Compare>
+    typename std::tuple_element<I, DataTuple>::type extreme(const Compare& compare) const
+    {
+        assert(num_stored() > 0);
+
+        std::vector<ExtremeKernel<I, Compare>> kernels;
+        reduce_column(column<I>(), kernels, compare);
+
+        auto* best = &kernels[0];
+        for (auto& kernel : kernels)
+            if (kernel.found && (!best->found || kernel.better(kernel.best, best->best)))
+                best = &kernel;
+
+        return best->best;
+    }
+
+    /**
+     * Counts the values in runs of rows that pass a test
+     */
+    template <std::size_t I, class Predicate>
+    struct CountKernel
+    {
+        CountKernel(const Predicate& predicate) : predicate(predicate), count(0) {}
+
+        void operator()(const DataTuple* rows, size_t n)
+        {
+            size_t c = 0;
+            for (size_t k = 0; k < n; k++)
+                c += predicate(std::get<I>(rows[k])) ? 1 : 0;
+
+            count += c;
+        }
+
+        Predicate predicate;
+        size_t count;
+    };
+
+    /**
+     * Finds the smallest and largest values in runs of rows (ignoring NaN and infinities)
+     */
+    template <std::size_t I>
+    struct RangeKernel
+    {
+        RangeKernel() : low(std::numeric_limits<double>::infinity()), high(-low) {}
+
+        void operator()(const DataTuple* rows, size_t count)
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                auto value = static_cast<double>(std::get<I>(rows[k]));
+                if (!std::isfinite(value))
+                    continue;
+
+                low = value < low ? value : low;
+                high = value > high ? value : high;
+            }
+        }
+
+        double low;
+        double high;
+    };
+
+    /**
+     * Counts the values in runs of rows in each bucket of a histogram
+     *
+     * Bucket 0 is below the first edge and the last bucket is above the last
+     * edge.  Neighbouring values are counted in four separate sets of counts,
+     * so values that land in the same bucket don't wait on each other.
+     */
+    template <std::size_t I>
+    struct HistogramKernel
+    {
+        HistogramKernel(const std::vector<double>& edges, bool uniform) :
+            edges(&edges),
+            uniform(uniform),
+            buckets(edges.size() + 1),
+            counts(4 * buckets, 0),
+            low(edges.front()),
+            high(edges.back()),
+            scale((edges.size() - 1) / (edges.back() - edges.front()))
+        {
+        }
+
+        void operator()(const DataTuple* rows, size_t count)
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                auto value = static_cast<double>(std::get<I>(rows[k]));
+                if (value != value) // NaN isn't in any bucket
+                    continue;
+
+                counts[(k & 3) * buckets + bucket(value)]++;
+            }
+        }
+
+        size_t bucket(double value) const
+        {
+            if (value < low)
+                return 0;
+
+            if (value >= high)
+                return value == high ? buckets - 2 : buckets - 1;
+
+            const double* first = edges->data();
+            if (uniform)
+            {
+                // Rounding can put a value one bucket out: check against the edges
+                auto b = std::min(static_cast<size_t>((value - low) * scale), buckets - 3);
+                b -= value < first[b];
+                b += value >= first[b + 1];
+                return b + 1;
+            }
+
+            // A binary search without branches: find the last edge <= value
+            size_t n = edges->size();
+            while (n > 1)
+            {
+                auto half = n / 2;
+                first = first[half] <= value ? first + half : first;
+                n -= half;
+            }
+
+            return first - edges->data() + 1;
+        }
+
+        /**
+         * The count for each bucket
+         */
+        uint64_t total(size_t b) const
+        {
+            return counts[b] + counts[buckets + b] + counts[2 * buckets + b] + counts[3 * buckets + b];
+        }
+
+        const std::vector<double>* edges;
+        bool uniform;
+        size_t buckets;
+        std::vector<uint64_t> counts;
+        double low;
+        double high;
+        double scale;
+    };
+
+    /**
+     * Count the values of a column in each bucket
+     *
+     * @param uniform Whether the edges are equally spaced, so a value's bucket can be calculated
+     */
+    template <std::size_t I>
+    VarTable<std::string, uint64_t, double> histogram(const std::vector<double>& edges, bool uniform) const
+    {
+        assert(edges.size() >= 2 && std::is_sorted(edges.begin(), edges.end()));
+
+        std::vector<HistogramKernel<I>> kernels;
+        reduce_column(column<I>(), kernels, edges, uniform);
+
+        // Merge the workers' histograms
+        std::vector<uint64_t> counts(edges.size() + 1, 0);
+        for (auto& kernel : kernels)
+            for (size_t b = 0; b < counts.size(); b++)
+                counts[b] += kernel.total(b);
+
+        return histogram_table(edges, counts);
+    }
+
+    /**
+     * Point at each stored row, in order
+     */
+    void stored_rows(std::vector<const DataTuple*>& rows) const
+    {
+        index_rows();
+        const size_t n = num_stored();
+        rows.reserve(n);
+
+        size_t chunk = 0;
+        for (size_t r = 0; r < n; r++)
+            rows.push_back(&stored_at(r, chunk));
+    }
+
+    /**
+     * Stream the rows through the window functions into a new table
+     */
+    template <std::size_t P, std::size_t... F, class... Functions>
+    VarTable<Ts..., typename Functions::type...> window_table(const std::vector<const DataTuple*>& rows,
+        VarTableIndexList<F...>,
+        const Functions&... functions) const
+    {
+        static_assert(sizeof...(Functions) > 0, "window() needs at least one function");
+
+        std::vector<std::string> headers = _headers;
+        for (auto& header : { functions.header... })
+            headers.push_back(header);
+
+        VarTable<Ts..., typename Functions::type...> table(headers, _static_column_size, _cell_padding);
+        table._executor = _executor;
+        table._data.reserve(rows.size());
+
+        std::unordered_map<typename std::tuple_element<P, DataTuple>::type, std::tuple<typename Functions::State...>,
+            VarTableHash, VarTableEqual> partitions;
+
+        for (auto row : rows)
+        {
+            auto& state = partitions[std::get<P>(*row)];
+
+            // Braces make the functions run in order
+            std::tuple<typename Functions::type...> values{ functions.next(std::get<F>(state), *row)... };
+            table.store_row(std::tuple_cat(*row, std::move(values)));
+        }
+
+        return table;
+    }
+
+    /**
+     * Make the table of a histogram, with each count as a percentage of them all
+     */
+    VarTable<std::string, uint64_t, double> histogram_table(const std::vector<double>& edges,
+        const std::vector<uint64_t>& counts) const
+    {
+        VarTable<std::string, uint64_t, double> table({ "Bucket", "Count", "Percent" });
+        table._executor = _executor;
+        table.setColumnFormat({ VarTableColumnFormat::AUTO, VarTableColumnFormat::AUTO, VarTableColumnFormat::PERCENT });
+
+        uint64_t total = 0;
+        for (auto count : counts)
+            total += count;
+
+        for (size_t b = 0; b < counts.size(); b++)
+        {
+            // The buckets outside the edges are only shown if they have something in them
+            if ((b == 0 || b == counts.size() - 1) && counts[b] == 0)
+                continue;
+
+            std::ostringstream bucket;
+            if (b == 0)
+                bucket << "< " << edges.front();
+            else if (b == counts.size() - 1)
+                bucket << "> " << edges.back();
+            else
+                bucket << "[" << edges[b - 1] << ", " << edges[b] << (b == counts.size() - 2 ? "]" : ")");
+
+            table.addRow(bucket.str(), counts[b], total > 0 ? 100.0 * counts[b] / static_cast<double>(total) : 0.0);
+        }
+
+        return table;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * Write lines of the current layout from the cursor on (see writeTo)
+     */
+    VarTableWriteStatus write_lines(int fd, VarTableCursor& cursor)
+    {
+        // Lines are rendered into this many bytes at a time
+        const size_t chunk_size = 16384;
+
+        VarTableStringBuf buf(_write_buffer);
+        std::ostream stream(&buf);
+
+        while (cursor.line < lineCount())
+        {
+            // Render as many whole lines as fit in the chunk, remembering where each one ends
+            _write_buffer.clear();
+            _write_line_ends.clear();
+
+            for (size_t line = cursor.line; line < lineCount() && _write_buffer.size() < chunk_size;
+                 line++)
+            {
+                printLine(stream, line);
+                stream << "\n";
+                _write_line_ends.push_back(_write_buffer.size());
+            }
+
+            // Write them, skipping whatever was already written of the first line
+            size_t written = cursor.offset;
+            while (written < _write_buffer.size())
+            {
+                auto result = ::write(fd, _write_buffer.data() + written, _write_buffer.size() - written);
+
+                if (result < 0 && errno == EINTR)
+                    continue;
+
+                // Nothing written without an error, which write() shouldn't do: don't leave errno stale
+                if (result == 0)
+                    errno = EIO;
+
+                if (result <= 0)
+                {
+                    // Remember which line we got up to and how far into it
+                    size_t line = 0;
+                    while (_write_line_ends[line] <= written)
+                        line++;
+
+                    cursor.offset = written - (line == 0 ? 0 : _write_line_ends[line - 1]);
+                    cursor.line += line;
+
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return VarTableWriteStatus::AGAIN;
+
+                    return VarTableWriteStatus::ERROR;
+                }
+
+                written += result;
+            }
+
+            cursor.line += _write_line_ends.size();
+            cursor.offset = 0;
+        }
+
+        return VarTableWriteStatus::DONE;
+    }
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * A row's sort key and index, as sorted and spilled by sortExternal()
+     */
+    template <class Key>
+    struct SortRecord
+    {
+        Key key;
+        uint64_t row;
+    };
+
+    /**
+     * Orders records by key (see sorts_before), then by row so equal keys keep their order
+     */
+    template <class Key>
+    struct SortRecordLess
+    {
+        SortRecordLess(bool ascending) : ascending(ascending) {}
+
+        bool operator()(const SortRecord<Key>& a, const SortRecord<Key>& b) const
+        {
+            if (sorts_before(a.key, b.key, ascending))
+                return true;
+            if (sorts_before(b.key, a.key, ascending))
+                return false;
+
+            return a.row < b.row;
+        }
+
+        bool ascending;
+    };
+
+    /**
+     * A temporary file (deleted as soon as it's made, so it goes when it's closed)
+     */
+    struct SpillFile
+    {
+        SpillFile() : fd(-1), size(0) {}
+        SpillFile(SpillFile&& other) : fd(other.fd), size(other.size) { other.fd = -1; }
+        SpillFile& operator=(SpillFile&& other)
+        {
+            std::swap(fd, other.fd);
+            std::swap(size, other.size);
+            return *this;
+        }
+        ~SpillFile()
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        int fd;
+        uint64_t size;
+    };
+
+    /**
+     * Reads the records of a spilled run through a buffer
+     */
+    template <class Key>
+    struct RunReader
+    {
+        RunReader(const SpillFile& file, size_t buffer_size) :
+            file(&file), offset(0), buffer(std::max<size_t>(buffer_size, 64)), start(0), end(0), failed(false)
+        {
+        }
+
+        /**
+         * Read the next record: false at the end of the run (or if reading failed)
+         */
+        bool next(SortRecord<Key>& record)
+        {
+            size_t key_size;
+            if (!read_key(record.key, key_size) || !fill(key_size + 8))
+                return false;
+
+            std::memcpy(&record.row, buffer.data() + start + key_size, 8);
+            start += key_size + 8;
+
+            return true;
+        }
+
+        /**
+         * Read the key at the front of the buffer, and how many bytes it takes up
+         */
+        bool read_key(std::string& key, size_t& key_size)
+        {
+            uint32_t size;
+            if (!fill(4))
+                return false;
+            std::memcpy(&size, buffer.data() + start, 4);
+
+            if (!fill(4 + size))
+                return false;
+            key.assign(buffer.data() + start + 4, size);
+
+            key_size = 4 + size;
+            return true;
+        }
+
+        template <class T>
+        bool read_key(T& key, size_t& key_size)
+        {
+            if (!fill(sizeof(T)))
+                return false;
+            std::memcpy(&key, buffer.data() + start, sizeof(T));
+
+            key_size = sizeof(T);
+            return true;
+        }
+
+        /**
+         * Make sure there are at least size bytes buffered
+         */
+        bool fill(size_t size)
+        {
+            if (end - start >= size)
+                return true;
+
+            // Move what's left to the front, and make room for a record bigger than the buffer
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            if (buffer.size() < size)
+                buffer.resize(size);
+
+            while (end < size && offset < file->size)
+            {
+                auto count = pread(file->fd, buffer.data() + end, buffer.size() - end, static_cast<off_t>(offset));
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                {
+                    failed = true;
+                    return false;
+                }
+
+                end += static_cast<size_t>(count);
+                offset += static_cast<uint64_t>(count);
+            }
+
+            return end >= size;
+        }
+
+        const SpillFile* file;
+        uint64_t offset;
+        std::vector<char> buffer;
+        size_t start;
+        size_t end;
+        bool failed;
+    };
+
+    template <class Key, class T>
+    static void set_sort_key(Key& key, const T& value) { key = value; }
+
+    static void set_sort_key(std::string& key, const char* value) { key = value ? value : ""; }
+
+    template <class Traits, class Allocator>
+    static void set_sort_key(std::string& key, const std::basic_string<char, Traits, Allocator>& value)
+    {
+        key.assign(value.data(), value.size());
+    }
+
+    static size_t sort_key_size(const std::string& key) { return key.capacity(); }
+
+    template <class T>
+    static size_t sort_key_size(const T&) { return 0; }
+
+    /**
+     * Append a record in the binary format: the key as a cell, then the row as a uint64
+     */
+    template <class Key>
+    static void encode_sort_record(std::string& buffer, const SortRecord<Key>& record)
+    {
+        BinaryCellWriter writer = { buffer };
+        writer(0, record.key);
+        writer.put(record.row);
+    }
+
+    /**
+     * Make a temporary file
+     */
+    static bool open_spill(const std::string& tmpdir, SpillFile& file)
+    {
+        std::string path = tmpdir + "/vartable-sort-XXXXXX";
+        file.fd = mkstemp(&path[0]);
+        if (file.fd < 0)
+            return false;
+
+        unlink(path.c_str());
+        return true;
+    }
+
+    /**
+     * Write out a buffer at the end of a temporary file, and empty it
+     */
+    static bool flush_spill(SpillFile& file, std::string& buffer)
+    {
+        size_t written = 0;
+        while (written < buffer.size())
+        {
+            auto count = pwrite(file.fd, buffer.data() + written, buffer.size() - written,
+                static_cast<off_t>(file.size + written));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+
+            written += static_cast<size_t>(count);
+        }
+
+        file.size += buffer.size();
+        buffer.clear();
+        return true;
+    }
+
+    /**
+     * Write a sorted run to a new temporary file
+     */
+    template <class Key>
+    static bool spill_run(const std::string& tmpdir, const std::vector<SortRecord<Key>>& records, SpillFile& file)
+    {
+        if (!open_spill(tmpdir, file))
+            return false;
+
+        std::string buffer;
+        for (auto& record : records)
+        {
+            encode_sort_record(buffer, record);
+            if (buffer.size() >= (64 << 10) && !flush_spill(file, buffer))
+                return false;
+        }
+
+        return flush_spill(file, buffer);
+    }
+
+    /**
+     * Merge some spilled runs, calling output(record) with each record in order
+     *
+     * @return false if reading failed or output() returned false
+     */
+    template <class Key, class Output>
+    static bool merge_runs(const std::vector<SpillFile>& runs, size_t first, size_t last,
+        size_t memory_budget, bool ascending, Output output)
+    {
+        // Each run and the output get an equal share of the budget
+        const size_t buffer_size = memory_budget / (last - first + 1);
+
+        std::vector<RunReader<Key>> readers;
+        readers.reserve(last - first);
+        for (size_t r = first; r < last; r++)
+            readers.emplace_back(runs[r], buffer_size);
+
+        // A heap of the next record from each run
+        typedef std::pair<SortRecord<Key>, size_t> Head;
+        SortRecordLess<Key> less(ascending);
+        auto after = [&less](const Head& a, const Head& b) { return less(b.first, a.first); };
+
+        std::vector<Head> heap;
+        for (size_t r = 0; r < readers.size(); r++)
+        {
+            Head head;
+            head.second = r;
+            if (readers[r].next(head.first))
+                heap.push_back(std::move(head));
+            else if (readers[r].failed)
+                return false;
+        }
+        std::make_heap(heap.begin(), heap.end(), after);
+
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), after);
+            auto& head = heap.back();
+
+            if (!output(head.first))
+                return false;
+
+            auto& reader = readers[head.second];
+            if (reader.next(head.first))
+                std::push_heap(heap.begin(), heap.end(), after);
+            else if (reader.failed)
+                return false;
+            else
+                heap.pop_back();
+        }
+
+        return true;
+    }
+#endif
+
+    /**
+     * Hash the given columns of a block of stored rows, a column at a time
+     *
+     * @param first The first row of the block
+     * @param hashes One hash for each row in the block
+     * @param chunk The block hint for stored_at()
+     */
+    template <std::size_t... I>
+    void hash_rows(VarTableIndexList<I...>, size_t first, std::vector<uint64_t>& hashes, size_t& chunk) const
+    {
+        std::fill(hashes.begin(), hashes.end(), 0);
+
+        int expand[] = { 0, (hash_column<I>(first, hashes, chunk), 0)... };
+        (void)expand;
+    }
+
+    /**
+     * Fold the hash of one column into the hashes of a block of stored rows
+     */
+    template <std::size_t I>
+    void hash_column(size_t first, std::vector<uint64_t>& hashes, size_t& chunk) const
+    {
+        VarTableHash hash;
+        for (size_t k = 0; k < hashes.size(); k++)
+            hashes[k] = VarTableHash::combine(hashes[k], hash(std::get<I>(stored_at(first + k, chunk))));
+    }
+
+    /**
+     * Whether two rows are equal in the given columns
+     */
+    template <std::size_t... I>
+    static bool equal_columns(VarTableIndexList<I...>, const DataTuple& a, const DataTuple& b)
+    {
+        VarTableEqual equal;
+        bool equals[] = { true, equal(std::get<I>(a), std::get<I>(b))... };
+
+        for (auto e : equals)
+            if (!e)
+                return false;
+
+        return true;
+    }
+
+    /**
+     * Remove rows that match an earlier row in the given columns
+     *
+     * The rows are hashed in parallel, then radix partitioned by hash (keeping
+     * their order) so each partition can be deduplicated on its own thread.
+     */
+    template <std::size_t... I>
+    size_t distinct_by(VarTableIndexList<I...> columns)
+    {
+        const size_t n = num_stored();
+        if (n == 0)
+            return 0;
+
+        index_rows();
+
+        const unsigned int workers = num_workers(n);
+        const unsigned int parts = workers;
+        const size_t block_rows = 1024;
+
+        auto partition_of = [parts](uint64_t h) { return static_cast<unsigned int>((h >> 32) % parts); };
+
+        // Hash each row and count how many rows each worker has for each partition
+        std::vector<uint64_t> hashes(n);
+        std::vector<size_t> counts(workers * parts, 0);
+
+        parallel_for(workers, [&](unsigned int w) {
+            size_t chunk = 0;
+            std::vector<uint64_t> block;
+
+            for (size_t first = n * w / workers, end = n * (w + 1) / workers; first < end; first += block_rows)
+            {
+                block.resize(std::min(block_rows, end - first));
+                hash_rows(columns, first, block, chunk);
+
+                for (size_t k = 0; k < block.size(); k++)
+                {
+                    hashes[first + k] = block[k];
+                    counts[w * parts + partition_of(block[k])]++;
+                }
+            }
+        });
+
+        // Lay the partitions out one after another, each in row order
+        std::vector<size_t> offsets(workers * parts);
+        std::vector<size_t> part_starts(parts + 1);
+        size_t total = 0;
+        for (unsigned int p = 0; p < parts; p++)
+        {
+            part_starts[p] = total;
+            for (unsigned int w = 0; w < workers; w++)
+            {
+                offsets[w * parts + p] = total;
+                total += counts[w * parts + p];
+            }
+        }
+        part_starts[parts] = total;
+
+        std::vector<size_t> order(n);
+        parallel_for(workers, [&](unsigned int w) {
+            for (size_t r = n * w / workers, end = n * (w + 1) / workers; r < end; r++)
+                order[offsets[w * parts + partition_of(hashes[r])]++] = r;
+        });
+
+        // Find the duplicates in each partition with an open addressing hash table of row numbers
+        std::vector<char> keep(n, 1);
+        std::vector<size_t> removed(parts, 0);
+
+        parallel_for(parts, [&](unsigned int p) {
+            size_t chunk = 0, other_chunk = 0;
+            size_t capacity = 16;
+            while (capacity < 2 * (part_starts[p + 1] - part_starts[p]))
+                capacity *= 2;
+
+            std::vector<size_t> table(capacity, 0); // Row number + 1, 0 for empty
+
+            for (size_t i = part_starts[p]; i < part_starts[p + 1]; i++)
+            {
+                auto r = order[i];
+                auto h = hashes[r];
+                auto& row = stored_at(r, chunk);
+
+                for (size_t slot = h & (capacity - 1);; slot = (slot + 1) & (capacity - 1))
+                {
+                    if (table[slot] == 0)
+                    {
+                        table[slot] = r + 1;
+                        break;
+                    }
+
+                    auto other = table[slot] - 1;
+                    if (hashes[other] == h && equal_columns(columns, stored_at(other, other_chunk), row))
+                    {
+                        keep[r] = 0;
+                        removed[p]++;
+                        break;
+                    }
+                }
+            }
+        });
+
+        size_t num_removed = 0;
+        for (auto count : removed)
+            num_removed += count;
+
+        if (num_removed)
+            remove_rows(keep);
+
+        return num_removed;
+    }
+
+    /**
+     * The number of rows that will be rendered
+     */
+    size_t num_rows() const { return num_stored() + _snapshot.size(); }
+
+    /**
+     * The r-th row to render: stored rows first, then the bound rows
+     */
+    const DataTuple& row_at(size_t r) const
+    {
+        return r < num_stored() ? stored_at(r) : _snapshot[r - num_stored()];
+    }
+
+    /**
+     * Whether the style has a line above the headers
+     */
+    bool has_top_border() const
+    {
+        return _print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY;
+    }
+
+    /**
+     * The number of lines before the first row: the top line, the headers and the line below them
+     */
+    size_t top_lines() const
+    {
+        return (has_top_border() ? 1 : 0) + 1 + (_print_style != PrintStyle::EMPTY ? 1 : 0);
+    }
+
+    /**
+     * The number of lines each row takes up
+     */
+    size_t lines_per_row() const { return _print_style == PrintStyle::FULL ? 2 : 1; }
+
+    /**
+     * The number of lines after the last row
+     */
+    size_t bottom_lines() const { return _print_style == PrintStyle::BASIC ? 1 : 0; }
+
+    /**
+     * Print the "|" between cells (or a space for the styles without them)
+     */
+    template <typename StreamType>
+    void print_separator(StreamType& stream)
+    {
+        if (_print_style != PrintStyle::SIMPLE && _print_style != PrintStyle::EMPTY)
+            stream << "|";
+        else
+            stream << " ";
+    }
+
+    /**
+     * Print out the headers
+     */
+    template <typename StreamType>
+    void print_header(StreamType& stream)
+    {
+        update_line_cache();
+        stream << _header_line;
+    }
+
+    /**
+     * Print out a single row
+     */
+    template <typename StreamType>
+    void print_row(StreamType& stream, size_t r)
+    {
+        // Find the colors for the block of rows this row is in
+        _row_styles = nullptr;
+        if (!_style_codes.empty())
+        {
+            if (r < _style_block_first || r - _style_block_first >= _style_block_rows)
+                color_block(r - r % _style_block_size);
+
+            _row_styles = &_cell_styles[(r - _style_block_first) * _num_columns];
+        }
+
+        _row_prefix_size = 0;
+        if (_tree_enabled && r < num_stored())
+            _row_prefix = tree_prefix(r, _row_prefix_size);
+
+        print_separator(stream);
+        print_each(read_row(r), stream);
+    }
+
+    /**
+     * Turn the color rules into a lookup for each column
+     *
+     * The values of a column are split into intervals at the edges of its rules,
+     * and each interval is given the style of the first rule that covers it.
+     */
+    void compile_color_rules()
+    {
+        _style_bounds.assign(_num_columns, std::vector<double>());
+        _style_ids.assign(_num_columns, std::vector<unsigned char>());
+        _style_codes.clear();
+        _style_block_rows = 0;
+        _version++;
+
+        if (_color_rules.empty())
+            return;
+
+        // Style 0 is no style at all
+        _style_codes.push_back("");
+
+        for (size_t c = 0; c < _color_rules.size(); c++)
+        {
+            auto& rules = _color_rules[c];
+            if (rules.empty())
+                continue;
+
+            auto& bounds = _style_bounds[c];
+            for (auto& rule : rules)
+            {
+                bounds.push_back(rule.low);
+                bounds.push_back(rule.high);
+            }
+
+            std::sort(bounds.begin(), bounds.end());
+            bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+            // Interval i is from bounds[i - 1] to bounds[i]: its lowest value is in every rule that covers it
+            for (size_t i = 0; i <= bounds.size(); i++)
+            {
+                double value = i == 0 ? -HUGE_VAL : bounds[i - 1];
+                unsigned char style = 0;
+
+                for (auto& rule : rules)
+                {
+                    if (rule.low <= value && value < rule.high)
+                    {
+                        auto code = "\033[" + rule.sgr + "m";
+                        auto found = std::find(_style_codes.begin(), _style_codes.end(), code);
+                        style = static_cast<unsigned char>(found - _style_codes.begin());
+
+                        if (found == _style_codes.end())
+                        {
+                            assert(_style_codes.size() < 256);
+                            _style_codes.push_back(code);
+                        }
+                        break;
+                    }
+                }
+
+                _style_ids[c].push_back(style);
+            }
+        }
+    }
+
+    /**
+     * Find the style of every cell in a block of rows, a column at a time
+     */
+    void color_block(size_t first)
+    {
+        _style_block_first = first;
+        _style_block_rows = std::min(_style_block_size, num_rows() - first);
+        _cell_styles.assign(_style_block_rows * _num_columns, 0);
+
+        color_each(std::integral_constant<size_t, 0>());
+    }
+
+    /**
+     * End the recursion
+     */
+    void color_each(std::integral_constant<size_t, std::tuple_size<DataTuple>::value>) {}
+
+    /**
+     * Style one column of the block, then the next
+     */
+    template <std::size_t I, typename = typename std::enable_if<I != std::tuple_size<DataTuple>::value>::type>
+    void color_each(std::integral_constant<size_t, I>)
+    {
+        auto& bounds = _style_bounds[I];
+        auto& ids = _style_ids[I];
+
+        if (!ids.empty())
+        {
+            for (size_t k = 0; k < _style_block_rows; k++)
+            {
+                double value = to_double(std::get<I>(read_row(_style_block_first + k)));
+                if (value == value) // Not NaN
+                    _cell_styles[k * _num_columns + I] =
+                    ids[std::upper_bound(bounds.begin(), bounds.end(), value) - bounds.begin()];
+            }
+        }
+
+        color_each(std::integral_constant<size_t, I + 1>());
+    }
+
+    /**
+     * The value of a numeric cell (NaN for anything else)
+     */
+    template <class T>
+    static double to_double(const T& value,
+        typename std::enable_if<std::is_arithmetic<T>::value>::type* /*dummy*/ = nullptr)
+    {
+        return static_cast<double>(value);
+    }
+
+    template <class T>
+    static double to_double(const T& /*value*/,
+        typename std::enable_if<!std::is_arithmetic<T>::value>::type* /*dummy*/ = nullptr)
+    {
+        return NAN;
+    }
+
+    /**
+     * Remembers the keys of the rows offered to addRowUnique()
+     */
+    class RowFilter
+    {
+    public:
+        virtual ~RowFilter() {}
+
+        /**
+         * Remember the key of a row
+         *
+         * @return False if the key was seen before
+         */
+        virtual bool insert(const DataTuple& row) = 0;
+    };
+
+    /**
+     * Remembers keys approximately, in fixed memory
+     */
+    template <std::size_t I>
+    class BloomRowFilter : public RowFilter
+    {
+    public:
+        BloomRowFilter(size_t expected_keys, double false_positive_rate)
+            : _filter(expected_keys, false_positive_rate)
+        {
+        }
+
+        bool insert(const DataTuple& row) override { return _filter.insert(VarTableHash()(std::get<I>(row))); }
+
+    protected:
+        VarTableBloomFilter _filter;
+    };
+
+    /**
+     * Remembers every key
+     */
+    template <std::size_t I>
+    class ExactRowFilter : public RowFilter
+    {
+    public:
+        bool insert(const DataTuple& row) override { return _keys.insert(std::get<I>(row)).second; }
+
+    protected:
+        std::unordered_set<typename std::tuple_element<I, DataTuple>::type, VarTableHash, VarTableEqual> _keys;
+    };
+
+    /**
+     * Where a row sits in the tree
+     */
+    struct TreeNode
+    {
+        TreeNode(size_t parent = std::numeric_limits<size_t>::max())
+            : parent(parent),
+            first_child(std::numeric_limits<size_t>::max()),
+            last_child(std::numeric_limits<size_t>::max()),
+            next_sibling(std::numeric_limits<size_t>::max()),
+            collapsed(false)
+        {
+        }
+
+        size_t parent;
+        size_t first_child;
+        size_t last_child;
+        size_t next_sibling;
+        bool collapsed;
+    };
+
+    /**
+     * The index of no row at all: the parent of the top level rows
+     */
+    static size_t no_node() { return std::numeric_limits<size_t>::max(); }
+
+    /**
+     * Store a row and hang it under its parent
+     */
+    size_t add_node(size_t parent, DataTuple&& row)
+    {
+        _data.emplace_back(std::move(row));
+        link_node(parent);
+
+        return _data.size() - 1;
+    }
+
+    /**
+     * Make the last stored row the last child of its parent
+     */
+    void link_node(size_t parent)
+    {
+        size_t slot = _tree_nodes.size();
+        _tree_nodes.emplace_back(parent);
+
+        auto& siblings = parent == no_node() ? _tree_top : _tree_nodes[parent];
+        if (siblings.last_child == no_node())
+            siblings.first_child = slot;
+        else
+            _tree_nodes[siblings.last_child].next_sibling = slot;
+        siblings.last_child = slot;
+
+        _tree_dirty = true;
+    }
+
+    /**
+     * Find the visible rows, in order, and the glyphs in front of each
+     *
+     * Only the visible rows are visited: hidden subtrees are skipped whole.
+     */
+    void index_tree() const
+    {
+        _tree_visible.clear();
+        _tree_prefixes.clear();
+        _tree_prefix_ends.clear();
+
+        // The glyphs for the levels above the row being visited
+        std::string indent;
+        size_t depth = 0;
+
+        size_t node = _tree_top.first_child;
+        while (node != no_node())
+        {
+            auto& links = _tree_nodes[node];
+            bool last = links.next_sibling == no_node();
+            bool has_children = links.first_child != no_node();
+            bool open = !links.collapsed && (_tree_levels == 0 || depth + 1 < _tree_levels);
+
+            _tree_visible.push_back(node);
+            _tree_prefixes += indent;
+            if (depth > 0)
+                _tree_prefixes += last ? "`-" : "|-";
+            if (has_children && !open)
+                _tree_prefixes += "+ ";
+            else if (depth > 0)
+                _tree_prefixes += "- ";
+            _tree_prefix_ends.push_back(_tree_prefixes.size());
+
+            if (has_children && open)
+            {
+                // The top level has no glyphs, so nothing to carry down
+                if (depth > 0)
+                    indent += last ? "    " : "|   ";
+                depth++;
+                node = links.first_child;
+                continue;
+            }
+
+            // Climb back up to the next row that has a sibling after it
+            while (node != no_node() && _tree_nodes[node].next_sibling == no_node())
+            {
+                node = _tree_nodes[node].parent;
+                if (node != no_node() && --depth > 0)
+                    indent.resize(indent.size() - 4);
+            }
+
+            if (node != no_node())
+                node = _tree_nodes[node].next_sibling;
+        }
+
+        _tree_dirty = false;
+    }
+
+    /**
+     * The glyphs in front of the r-th visible row
+     */
+    const char* tree_prefix(size_t r, size_t& size) const
+    {
+        size_t begin = r ? _tree_prefix_ends[r - 1] : 0;
+        size = _tree_prefix_ends[r] - begin;
+
+        return _tree_prefixes.data() + begin;
+    }
+
+    /**
+     * A table derived from this one, updated as rows are added (see materialize)
+     */
+    class MaterializedView
+    {
+    public:
+        MaterializedView() : stale(false) {}
+        virtual ~MaterializedView() {}
+
+        /**
+         * Fold in a row that has just been added
+         */
+        virtual void add(const DataTuple& row) = 0;
+
+        /**
+         * Work the view out again from all the rows
+         */
+        virtual void rebuild() = 0;
+
+        /// Whether the rows have changed in a way add() can't follow
+        bool stale;
+    };
+
+    /**
+     * Summarizes column V for each key of column K
+     */
+    template <std::size_t K, std::size_t V>
+    class GroupView : public MaterializedView
+    {
+    public:
+        GroupView(const VarTable& source, std::function<bool(const DataTuple&)> filter)
+            : table({ source._headers[K], "Count", "Sum", "Mean", "Min", "Max" }, source._static_column_size,
+                source._cell_padding),
+            _source(source),
+            _filter(std::move(filter))
+        {
+            table._executor = source._executor;
+            table._before_render = [this]() {
+                if (this->stale)
+                    rebuild();
+            };
+        }
+
+        void add(const DataTuple& row) override
+        {
+            // A stale view is about to be rebuilt anyway
+            if (this->stale || (_filter && !_filter(row)))
+                return;
+
+            auto& value = std::get<V>(row);
+            auto found = _groups.find(std::get<K>(row));
+            if (found == _groups.end())
+                found = _groups.emplace(std::get<K>(row), Group(_groups.size(), value)).first;
+            else
+                found->second.add(value);
+
+            auto& group = found->second;
+            table.setRow(group.row, std::get<K>(row), group.count, group.sum,
+                static_cast<double>(group.sum) / group.count, group.min, group.max);
+        }
+
+        void rebuild() override
+        {
+            this->stale = false;
+            _groups.clear();
+            table.resetForRebuild();
+
+            _source.for_each_stored([this](const DataTuple& row) { add(row); });
+        }
+
+        GroupTable<K, V> table;
+
+    protected:
+        typedef typename std::tuple_element<K, DataTuple>::type Key;
+        typedef typename std::tuple_element<V, DataTuple>::type Value;
+
+        struct Group
+        {
+            Group(size_t row, const Value& value) : row(row), count(1), sum(value), min(value), max(value) {}
+
+            void add(const Value& value)
+            {
+                count++;
+                sum += value;
+                min = std::min(min, value);
+                max = std::max(max, value);
+            }
+
+            size_t row;
+            uint64_t count;
+            typename VarTableAccumulator<Value>::type sum;
+            Value min;
+            Value max;
+        };
+
+        const VarTable& _source;
+        std::function<bool(const DataTuple&)> _filter;
+        std::unordered_map<Key, Group, VarTableHash, VarTableEqual> _groups;
+    };
+
+    /**
+     * Fold a row that is being added into the views
+     */
+    void update_views(const DataTuple& row)
+    {
+        for (auto& view : _views)
+            view->add(row);
+    }
+
+    /**
+     * The rows have changed in some way other than being added: the views need rebuilding
+     */
+    void mark_views_stale()
+    {
+        for (auto& view : _views)
+            view->stale = true;
+    }
+
+    /**
+     * Call f with every stored row, in no particular order
+     *
+     * Includes the rows of a tree that are hidden.
+     */
+    template <class F>
+    void for_each_stored(F&& f) const
+    {
+        if (_sort_less)
+        {
+            for (auto& chunk : _chunks)
+                for (auto& row : chunk)
+                    f(row);
+            return;
+        }
+
+        for (size_t slot = 0; slot < _data.size(); slot++)
+            if (!_expiry_enabled || _alive[slot])
+                f(_data[slot]);
+    }
+
+    /**
+     * Finds rows by their key for upsertRow()
+     */
+    class RowIndex
+    {
+    public:
+        virtual ~RowIndex() {}
+
+        /**
+         * Remember which row has a row's key
+         */
+        virtual void insert(const DataTuple& row, size_t r) = 0;
+
+        /**
+         * Overwrite the row with the same key as row, or add it
+         *
+         * @return The row's index
+         */
+        virtual size_t upsert(VarTable& table, DataTuple&& row) = 0;
+    };
+
+    /**
+     * Keeps the keys of column I in stripes, each with its own lock
+     */
+    template <std::size_t I>
+    class StripedRowIndex : public RowIndex
+    {
+    public:
+        StripedRowIndex(size_t stripes) : _stripes(stripes) {}
+
+        void insert(const DataTuple& row, size_t r) override
+        {
+            stripe(std::get<I>(row)).rows[std::get<I>(row)] = r;
+        }
+
+        size_t upsert(VarTable& table, DataTuple&& row) override
+        {
+            // Holding the key's stripe means nobody else can add the same key meanwhile
+            auto& keys = stripe(std::get<I>(row));
+            std::lock_guard<std::mutex> lock(keys.mutex);
+
+            auto found = keys.rows.find(std::get<I>(row));
+            if (found != keys.rows.end())
+            {
+                table.update_concurrently(found->second, [&](DataTuple& stored) { stored = std::move(row); });
+                return found->second;
+            }
+
+            Key key = std::get<I>(row);
+            size_t r = table.append_row(std::move(row));
+            keys.rows.emplace(std::move(key), r);
+
+            return r;
+        }
+
+    protected:
+        typedef typename std::tuple_element<I, DataTuple>::type Key;
+
+        struct Stripe
+        {
+            std::mutex mutex;
+            std::unordered_map<Key, size_t, VarTableHash, VarTableEqual> rows;
+        };
+
+        Stripe& stripe(const Key& key) { return _stripes[VarTableHash()(key) % _stripes.size()]; }
+
+        std::vector<Stripe> _stripes;
+    };
+
+    /**
+     * A lock on a stripe of rows, padded so neighbouring locks don't share a cache line
+     */
+    struct RowLock
+    {
+        std::mutex mutex;
+        char padding[64 - sizeof(std::mutex) % 64];
+    };
+
+    /**
+     * Everything enableConcurrentUpdates() shares between threads
+     */
+    struct ConcurrentState
+    {
+        ConcurrentState(size_t num_columns, size_t stripes)
+            : row_locks(new RowLock[stripes]),
+            num_row_locks(stripes),
+            widths(new std::atomic<unsigned int>[num_columns]()),
+            rows(0),
+            visible(0),
+            updates(0)
+        {
+        }
+
+        /// Row r is guarded by row_locks[r % num_row_locks]
+        std::unique_ptr<RowLock[]> row_locks;
+        size_t num_row_locks;
+
+        /// The widest cell written to each column
+        std::unique_ptr<std::atomic<unsigned int>[]> widths;
+
+        /// The number of rows added, published once each row is in place
+        std::atomic<size_t> rows;
+
+        /// The number of rows as of the last layout(): only the renderer uses it
+        size_t visible;
+
+        /// Counts the changes for version()
+        std::atomic<uint64_t> updates;
+
+        /// Taken to add a row
+        std::mutex append_mutex;
+
+        /// The renderer's copy of the row it's printing
+        std::unique_ptr<DataTuple> copy;
+
+        /// Finds rows for upsertRow()
+        std::unique_ptr<RowIndex> keys;
+    };
+
+    /**
+     * The lock guarding a row
+     */
+    std::mutex& row_mutex(size_t r) { return _concurrent->row_locks[r % _concurrent->num_row_locks].mutex; }
+
+    /**
+     * Add a row at the end, from any thread
+     *
+     * Rows only move when the reserved room runs out, and then every stripe is
+     * locked so nobody is looking at them.
+     */
+    size_t append_row(DataTuple&& row)
+    {
+        auto& state = *_concurrent;
+        raise_widths(row);
+
+        std::lock_guard<std::mutex> lock(state.append_mutex);
+
+        if (_data.size() == _data.capacity())
+        {
+            std::vector<std::unique_lock<std::mutex>> locks;
+            locks.reserve(state.num_row_locks);
+            for (size_t i = 0; i < state.num_row_locks; i++)
+                locks.emplace_back(state.row_locks[i].mutex);
+
+            _data.emplace_back(std::move(row));
+        }
+        else
+            _data.emplace_back(std::move(row));
+
+        state.updates.fetch_add(1, std::memory_order_relaxed);
+        state.rows.store(_data.size(), std::memory_order_release);
+
+        return _data.size() - 1;
+    }
+
+    /**
+     * Change a row under its lock, from any thread
+     */
+    template <class Update>
+    void update_concurrently(size_t row, Update&& update)
+    {
+        assert(row < _concurrent->rows.load(std::memory_order_acquire));
+
+        std::lock_guard<std::mutex> lock(row_mutex(row));
+        update(_data[row]);
+        raise_widths(_data[row]);
+
+        _concurrent->updates.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Widen the columns to fit a row, if it's the widest yet
+     */
+    void raise_widths(const DataTuple& row)
+    {
+        // Each writer sizes its rows on its own
+        static thread_local std::vector<unsigned int> sizes;
+        sizes.resize(_num_columns);
+        size_each(row, sizes);
+
+        for (unsigned int i = 0; i < _num_columns; i++)
+        {
+            auto& width = _concurrent->widths[i];
+            unsigned int current = width.load(std::memory_order_relaxed);
+            while (current < sizes[i] && !width.compare_exchange_weak(current, sizes[i], std::memory_order_relaxed))
+            {
+            }
+        }
+    }
+
+    /**
+     * The r-th row to render, copied under its lock if other threads may be writing it
+     *
+     * The copy is only good until the next call.
+     */
+    const DataTuple& read_row(size_t r)
+    {
+        if (!_concurrent || r >= num_stored())
+            return row_at(r);
+
+        auto& copy = _concurrent->copy;
+        std::lock_guard<std::mutex> lock(row_mutex(r));
+
+        if (copy)
+            *copy = _data[r];
+        else
+            copy.reset(new DataTuple(_data[r]));
+
+        return *copy;
+    }
+
+    /**
+     * Render a line into the line buffer (unless it's already there)
+     */
+    const std::string& render_line(size_t line)
+    {
+        if (_line_buffer_line != line)
+        {
+            _line_buffer.clear();
+
+            VarTableStringBuf buf(_line_buffer);
+            std::ostream stream(&buf);
+            printLine(stream, line);
+
+            _line_buffer_line = line;
+        }
+
+        return _line_buffer;
+    }
+
+    /**
+     * Print the rows of one, three and last
+     */
+    template <typename StreamType>
+    void print_plus(StreamType& stream)
+    {
+        update_line_cache();
+        stream << _border_line;
+    }
+
+    /**
+     * Remake the border and header lines if the column sizes or the style have changed
+     */
+    void update_line_cache()
+    {
+        if (_line_cache_sizes == _column_sizes && _line_cache_style == _print_style && !_header_line.empty())
+            return;
+
+        _line_cache_sizes = _column_sizes;
+        _line_cache_style = _print_style;
+
+        std::ostringstream border;
+        switch (_print_style)
+        {
+        case PrintStyle::BASIC:
+        case PrintStyle::FULL:
+            border << "+";
+            for (unsigned int i = 0; i < _num_columns; i++)
+                border << std::string(_column_sizes[i] + (2 * _cell_padding), '-') << "+";
+            break;
+        case PrintStyle::SIMPLE:
+            border << " ";
+            for (unsigned int i = 0; i < _num_columns; i++)
+                border << std::string(_column_sizes[i] + (2 * _cell_padding), '-') << " ";
+            break;
+        default:
+            break;
+        }
+        _border_line = border.str();
+
+        std::ostringstream header;
+        print_separator(header);
+        for (unsigned int i = 0; i < _num_columns; i++)
+        {
+            // Must find the center of the column
+            auto half = _column_sizes[i] / 2;
+            half -= _headers[i].size() / 2;
+
+            header << std::string(_cell_padding, ' ') << std::setw(_column_sizes[i]) << std::left
+                << std::string(half, ' ') + _headers[i] << std::string(_cell_padding, ' ');
+
+            print_separator(header);
+        }
+        _header_line = header.str();
+    }
+
+    /**
+     * Finds the size each column should be and set it in _column_sizes
+     */
+    void size_columns() { size_columns(0, num_rows()); }
+
+    /**
+     * Finds the size each column should be to fit rows first to last - 1
+     */
+    void size_columns(size_t first, size_t last)
+    {
+        _column_sizes.resize(_num_columns);
+
+        // Temporary for querying each row
+        auto& column_sizes = _row_sizes;
+        column_sizes.resize(_num_columns);
+
+        // Start with the size of the headers (or the minimum size if that's bigger)
+        for (unsigned int i = 0; i < _num_columns; i++)
+        {
+            _column_sizes[i] = _headers[i].size();
+            if (i < _minimum_column_sizes.size())
+                _column_sizes[i] = std::max(_column_sizes[i], _minimum_column_sizes[i]);
+        }
+
+        // The widths of rows that can expire are already counted
+        if (_expiry_enabled && first == 0 && last == num_rows())
+        {
+            for (unsigned int i = 0; i < _num_columns; i++)
+                _column_sizes[i] = std::max(_column_sizes[i], _width_histogram.max(i));
+
+            first = num_stored();
+        }
+
+        // So are the widths of rows other threads write
+        if (_concurrent && first == 0 && last == num_rows())
+        {
+            for (unsigned int i = 0; i < _num_columns; i++)
+                _column_sizes[i] = std::max(_column_sizes[i],
+                    _concurrent->widths[i].load(std::memory_order_relaxed));
+
+            first = num_stored();
+        }
+
+        // Grab the size of each entry of each row and see if it's bigger
+        for (size_t r = first; r < last; r++)
+        {
+            size_each(read_row(r), column_sizes);
+
+            if (_tree_enabled && r < num_stored())
+            {
+                size_t prefix_size;
+                tree_prefix(r, prefix_size);
+                column_sizes[0] += prefix_size;
+            }
+
+            for (unsigned int i = 0; i < _num_columns; i++)
+                _column_sizes[i] = std::max(_column_sizes[i], column_sizes[i]);
+        }
+    }
+
+    /// The column headers
+    std::vector<std::string> _headers;
+
+    /// Number of columns in the table
+    unsigned int _num_columns;
+
+    /// Size of columns that we can't get the size of
+    unsigned int _static_column_size;
+
+    /// Size of the cell padding
+    unsigned int _cell_padding;
+
+    /// The actual data
+    RowVector _data;
+
+    /// The bound (live) rows
+    std::vector<std::tuple<VarTableBinding<Ts>...>> _bindings;
+
+    /// The values of the bound rows as of the last render
+    RowVector _snapshot;
+
+    /// The bound rows and column sizes writeTo() is writing, as of _write_version
+    RowVector _write_snapshot;
+    std::vector<unsigned int> _write_column_sizes;
+    uint64_t _write_version;
+
+    /// Counts the layouts made by writeTo() (0 before the first)
+    uint64_t _write_layout;
+
+    /// The lines being written by writeTo()
+    std::string _write_buffer;
+
+    /// Where each line in _write_buffer ends
+    std::vector<size_t> _write_line_ends;
+
+    /// Holds the printable width of each column
+    std::vector<unsigned int> _column_sizes;
+
+    /// The smallest each column may be (see setMinimumColumnSizes)
+    std::vector<unsigned int> _minimum_column_sizes;
+
+    /// Column Format
+    std::vector<VarTableColumnFormat> _column_format;
+
+    /// Print Style
+    PrintStyle _print_style;
+
+    /// Alignment Style
+    std::vector<AlignmentStyle> _alignment_style;
+
+    /// Precision For each column
+    std::vector<int> _precision;
+
+    /// Orders the rows when they are kept sorted (see setSortedInsert)
+    bool (*_sort_less)(const DataTuple&, const DataTuple&);
+
+    /// How many rows a sorted block holds after it is split
+    static const size_t _chunk_rows = 256;
+
+    /// The rows, in sorted blocks, when they are kept sorted
+    std::vector<RowVector> _chunks;
+
+    /// The number of rows in _chunks
+    size_t _sorted_size;
+
+    /// The index of the first row of each block (rebuilt when needed)
+    mutable std::vector<size_t> _chunk_starts;
+
+    /// The block the last row looked up was in
+    mutable size_t _last_chunk;
+
+    /// Remembers keys for addRowUnique()
+    std::unique_ptr<RowFilter> _unique_filter;
+
+    /// Whether rows can expire (see enableExpiry)
+    bool _expiry_enabled;
+
+    /// The time tick 0 of the expiry wheel
+    std::chrono::steady_clock::time_point _expiry_epoch;
+
+    /// The length of a tick of the expiry wheel
+    std::chrono::steady_clock::duration _expiry_resolution;
+
+    /// When each row expires
+    VarTableTimerWheel _expiry_wheel;
+
+    /// Whether each slot of _data holds a live row
+    std::vector<char> _alive;
+
+    /// How many rows have expired from each slot (see VarTableRowHandle)
+    std::vector<uint64_t> _generations;
+
+    /// Slots of _data left by expired rows
+    std::vector<size_t> _free_slots;
+
+    /// The slots holding live rows, in order (rebuilt when needed)
+    mutable std::vector<size_t> _live_rows;
+
+    /// Whether _live_rows is out of date
+    mutable bool _live_rows_dirty;
+
+    /// The widths of the cells of the live rows
+    VarTableWidthHistogram _width_histogram;
+
+    /// Temporary for the widths of a single row
+    std::vector<unsigned int> _row_sizes;
+
+    /// The number of changes the change feed keeps (0 when it's off)
+    size_t _feed_capacity;
+
+    /// The ring of recent changes
+    std::vector<VarTableChange<DataTuple>> _feed;
+
+    /// The sequence number of the next change
+    uint64_t _feed_next;
+
+    /// The sequence number of the oldest change in the ring (unless it's been overwritten since)
+    uint64_t _feed_first;
+
+    /// Changes every time the stored rows or the formatting change
+    uint64_t _version;
+
+    /// The color rules for each column
+    std::vector<std::vector<VarTableColorRule>> _color_rules;
+
+    /// The edges of the intervals the color rules split each column's values into
+    std::vector<std::vector<double>> _style_bounds;
+
+    /// The style of each interval of each column
+    std::vector<std::vector<unsigned char>> _style_ids;
+
+    /// The escape code that starts each style (empty if there are no rules)
+    std::vector<std::string> _style_codes;
+
+    /// The number of rows styled at a time
+    static const size_t _style_block_size = 256;
+
+    /// The style of each cell in the current block of rows
+    std::vector<unsigned char> _cell_styles;
+
+    /// The first row of the current block
+    size_t _style_block_first;
+
+    /// The number of rows in the current block (0 if there isn't one)
+    size_t _style_block_rows;
+
+    /// The styles of the cells of the row being printed (or nullptr)
+    const unsigned char* _row_styles;
+
+    /// Rows kept by resetForRebuild() to be reused
+    RowVector _spare_rows;
+
+    /// The next spare row to reuse
+    size_t _spare_next;
+
+    /// The border and header lines, as of the column sizes and style they were made for
+    std::string _border_line;
+    std::string _header_line;
+    std::vector<unsigned int> _line_cache_sizes;
+    PrintStyle _line_cache_style;
+
+    /// The line rendered for lines(), and which line it is
+    std::string _line_buffer;
+    size_t _line_buffer_line;
+
+    /// The locks and widths shared with other threads (see enableConcurrentUpdates)
+    std::unique_ptr<ConcurrentState> _concurrent;
+
+    /// Whether the rows are nodes of a tree (see enableTree)
+    bool _tree_enabled;
+
+    /// The links of each node, by slot
+    std::vector<TreeNode> _tree_nodes;
+
+    /// Links to the top level nodes
+    TreeNode _tree_top;
+
+    /// How many levels of the tree to show (0 for all)
+    size_t _tree_levels;
+
+    /// The slots of the visible nodes, in the order they're printed
+    mutable std::vector<size_t> _tree_visible;
+
+    /// The glyphs in front of each visible node, one after the other, and where each ends
+    mutable std::string _tree_prefixes;
+    mutable std::vector<size_t> _tree_prefix_ends;
+
+    /// Whether _tree_visible is out of date
+    mutable bool _tree_dirty;
+
+    /// The tree glyphs of the row being printed
+    const char* _row_prefix;
+    size_t _row_prefix_size;
+
+    /// The tables kept up to date from this one (see materialize)
+    std::vector<std::unique_ptr<MaterializedView>> _views;
+
+    /// Brings the rows up to date before they're rendered or read (set on the table of a view)
+    std::function<void()> _before_render;
+
+    /// Runs the parallel operations
+    VarTableExecutor* _executor;
+};
+
+template <class... Ts>
+const size_t VarTable<Ts...>::_chunk_rows;
+
+template <class... Ts>
+const size_t VarTable<Ts...>::_style_block_size;
+
+/**
+ * A set of tables that are printed together
+ *
+ * The widths of the columns are shared between the tables (column i of every
+ * table is as wide as the widest column i of any of them) so related tables
+ * line up.  The tables can then be printed one above the other, or next to each
+ * other: in that case each table is streamed a line at a time, so no table is
+ * rendered to a string first.
+ *
+ * The tables are referenced, not copied: they must outlive the group.
+ *
+ * TableGroup group;
+ * group.add(cpu_table);
+ * group.add(memory_table);
+ * group.printHorizontal(std::cout);
+ */
+class TableGroup
+{
+public:
+    /**
+     * Construct an empty group
+     *
+     * @param spacing The number of spaces between tables printed next to each other
+     */
+    TableGroup(unsigned int spacing = 2) : _spacing(spacing), _share_widths(true) {}
+
+    /**
+     * Add a table to the group
+     */
+    template <class... Ts>
+    void add(VarTable<Ts...>& table)
+    {
+        _tables.emplace_back(new Member<VarTable<Ts...>>(table));
+    }
+
+    /**
+     * Set whether columns are made the same width across the tables (the default)
+     */
+    void setShareWidths(bool share_widths) { _share_widths = share_widths; }
+
+    /**
+     * Print the tables one above the other
+     */
+    void printVertical(std::ostream& stream)
+    {
+        layout();
+
+        for (auto& table : _tables)
+        {
+            for (size_t line = 0; line < table->lineCount(); line++)
+            {
+                table->printLine(stream, line);
+                stream << "\n";
+            }
+        }
+    }
+
+    /**
+     * Print the tables next to each other
+     *
+     * Shorter tables are padded with blank lines at the bottom.
+     */
+    void printHorizontal(std::ostream& stream)
+    {
+        layout();
+
+        size_t num_lines = 0;
+        for (auto& table : _tables)
+            num_lines = std::max(num_lines, table->lineCount());
+
+        const std::string gap(_spacing, ' ');
+
+        for (size_t line = 0; line < num_lines; line++)
+        {
+            // Don't pad out tables that have nothing to the right of them
+            size_t last = _tables.size();
+            while (line >= _tables[last - 1]->lineCount())
+                last--;
+
+            for (size_t t = 0; t < last; t++)
+            {
+                if (t != 0)
+                    stream << gap;
+
+                if (line < _tables[t]->lineCount())
+                    _tables[t]->printLine(stream, line);
+                else
+                    stream << std::string(_tables[t]->width(), ' ');
+            }
+
+            stream << "\n";
+        }
+    }
+
+protected:
+    /**
+     * The interface to a table that doesn't depend on its column types
+     */
+    class Table
     {
-        return data.size();
+    public:
+        virtual ~Table() {}
+        virtual void setMinimumColumnSizes(const std::vector<unsigned int>& minimum_sizes) = 0;
+        virtual void layout() = 0;
+        virtual const std::vector<unsigned int>& columnSizes() const = 0;
+        virtual size_t width() const = 0;
+        virtual size_t lineCount() const = 0;
+        virtual void printLine(std::ostream& stream, size_t line) = 0;
+    };
+
+    /**
+     * Forwards the interface to a VarTable
+     */
+    template <class TableType>
+    class Member : public Table
+    {
+    public:
+        Member(TableType& table) : _table(table) {}
+
+        void setMinimumColumnSizes(const std::vector<unsigned int>& minimum_sizes) override
+        {
+            _table.setMinimumColumnSizes(minimum_sizes);
+        }
+        void layout() override { _table.layout(); }
+        const std::vector<unsigned int>& columnSizes() const override
+        {
+            return _table.columnSizes();
+        }
+        size_t width() const override { return _table.width(); }
+        size_t lineCount() const override { return _table.lineCount(); }
+        void printLine(std::ostream& stream, size_t line) override { _table.printLine(stream, line); }
+
+    protected:
+        TableType& _table;
+    };
+
+    /**
+     * Find the width of every column of every table, in a single pass over each table
+     */
+    void layout()
+    {
+        if (!_share_widths)
+        {
+            for (auto& table : _tables)
+            {
+                table->setMinimumColumnSizes(std::vector<unsigned int>());
+                table->layout();
+            }
+            return;
+        }
+
+        // Size each table on its own
+        std::vector<unsigned int> shared_sizes;
+        for (auto& table : _tables)
+        {
+            table->setMinimumColumnSizes(std::vector<unsigned int>());
+            table->layout();
+
+            auto& sizes = table->columnSizes();
+            if (shared_sizes.size() < sizes.size())
+                shared_sizes.resize(sizes.size(), 0);
+
+            for (size_t i = 0; i < sizes.size(); i++)
+                shared_sizes[i] = std::max(shared_sizes[i], sizes[i]);
+        }
+
+        // Then widen them all to the widest
+        for (auto& table : _tables)
+            table->setMinimumColumnSizes(shared_sizes);
     }
 
+    /// Spaces between tables printed next to each other
+    unsigned int _spacing;
+
+    /// Whether the columns have the same width in all of the tables
+    bool _share_widths;
+
+    /// The tables in the group
+    std::vector<std::unique_ptr<Table>> _tables;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Reads an Apache Arrow IPC stream or file by mapping it into memory
+ *
+ * Numeric columns are used where they are in the file, with no copying:
+ * values<T>() points straight at a column of a record batch.  Integer,
+ * floating point, bool and UTF-8 columns are supported, which covers
+ * everything exportArrowIPC() writes.
+ *
+ * VarTableArrowReader reader;
+ * if (reader.open("hosts.arrows"))
+ *     reader.readInto(vt);
+ */
+class VarTableArrowReader
+{
+public:
     /**
-     * Try to find the size the column will take up
+     * The type of a column
+     */
+    struct Column
+    {
+        /// Its name
+        std::string name;
+
+        /// The Arrow Type union id: 2 Int, 3 FloatingPoint, 5 Utf8 or 6 Bool
+        unsigned char type;
+
+        /// The size of each value in bits (0 for Utf8 and Bool)
+        unsigned int bit_width;
+
+        /// Whether an Int is signed
+        bool is_signed;
+    };
+
+    VarTableArrowReader() : _map(nullptr), _size(0) {}
+
+    ~VarTableArrowReader() { close(); }
+
+    VarTableArrowReader(const VarTableArrowReader&) = delete;
+    VarTableArrowReader& operator=(const VarTableArrowReader&) = delete;
+
+    /**
+     * Map a file and read its schema and where each record batch is
      *
-     * If the datatype is an integer - let's get it's length
+     * @return false if the file can't be read, isn't Arrow, or has a type that isn't supported
      */
-    template <class T>
-    size_t sizeOfData(const T& data,
-        typename std::enable_if<std::is_integral<T>::value>::type* /*dummy*/ = nullptr)
+    bool open(const std::string& path)
     {
-        if (data == 0)
-            return 1;
+        close();
 
-        return std::log10(data) + 1;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0)
+        {
+            _size = static_cast<size_t>(info.st_size);
+            void* map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            _map = map == MAP_FAILED ? nullptr : static_cast<const char*>(map);
+        }
+        ::close(fd);
+
+        if (!_map || !read_messages())
+        {
+            close();
+            return false;
+        }
+
+        return true;
     }
 
     /**
-     * If it doesn't... let's just use a statically set size
+     * Unmap the file
      */
-    size_t sizeOfData(...) { return _static_column_size; }
+    void close()
+    {
+        if (_map)
+            munmap(const_cast<char*>(_map), _size);
+
+        _map = nullptr;
+        _size = 0;
+        _columns.clear();
+        _batches.clear();
+    }
 
     /**
-     * These three functions iterate over the Tuple, find the printed size of each element and set it
-     * in a vector
+     * The columns
      */
+    const std::vector<Column>& columns() const { return _columns; }
 
-     /**
-      * End the recursion
-      */
-    template <typename TupleType>
-    void size_each(TupleType&&,
-        std::vector<unsigned int>& /*sizes*/,
-        std::integral_constant<
-        size_t,
-        std::tuple_size<typename std::remove_reference<TupleType>::type>::value>)
+    /**
+     * The number of record batches
+     */
+    size_t batches() const { return _batches.size(); }
+
+    /**
+     * The number of rows in a record batch
+     */
+    size_t batchRows(size_t batch) const { return _batches[batch].rows; }
+
+    /**
+     * The number of rows in all of the record batches
+     */
+    size_t rows() const
     {
+        size_t rows = 0;
+        for (auto& batch : _batches)
+            rows += batch.rows;
+
+        return rows;
     }
 
     /**
-     * Recursively called for each element
+     * The values of an Int or FloatingPoint column in a record batch, where they are in the file
+     *
+     * @return nullptr if T isn't the column's type
      */
-    template <std::size_t I,
-        typename TupleType,
-        typename = typename std::enable_if<
-        I != std::tuple_size<typename std::remove_reference<TupleType>::type>::value>::type>
-        void
-        size_each(TupleType&& t, std::vector<unsigned int>& sizes, std::integral_constant<size_t, I>)
+    template <class T>
+    const T* values(size_t batch, size_t column) const
     {
-        sizes[I] = sizeOfData(std::get<I>(t));
+        static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value,
+            "Only numbers can be read in place");
 
-        // Override for Percent
-        if (!_column_format.empty())
-            if (_column_format[I] == VarTableColumnFormat::PERCENT)
-                sizes[I] = 6; // 100.00
+        auto& type = _columns[column];
+        bool matches = std::is_floating_point<T>::value ? type.type == 3 :
+            type.type == 2 && type.is_signed == std::is_signed<T>::value;
 
-            // Continue the recursion
-        size_each(std::forward<TupleType>(t), sizes, std::integral_constant<size_t, I + 1>());
+        const char* data;
+        if (!matches || type.bit_width != 8 * sizeof(T) ||
+            !buffer(batch, column, 1, data, sizeof(T) * _batches[batch].rows) ||
+            reinterpret_cast<uintptr_t>(data) % alignof(T))
+            return nullptr;
+
+        return reinterpret_cast<const T*>(data);
     }
 
     /**
-     * The function that is actually called that starts the recursion
+     * Whether a value isn't null
      */
-    template <typename TupleType>
-    void size_each(TupleType&& t, std::vector<unsigned int>& sizes)
+    bool valid(size_t batch, size_t column, size_t row) const
     {
-        size_each(std::forward<TupleType>(t), sizes, std::integral_constant<size_t, 0>());
+        auto& node = _batches[batch].nodes[column];
+        if (node.null_count == 0)
+            return true;
+
+        const char* bits;
+        return buffer(batch, column, 0, bits, (_batches[batch].rows + 7) / 8) &&
+            (bits[row / 8] >> (row % 8)) & 1;
     }
 
     /**
-     * Print the rows of one, three and last
+     * A value of any numeric or Bool column, as T (T() if it's null)
      */
-    template <typename StreamType>
-    void print_plus(StreamType& stream)
+    template <class T>
+    T number(size_t batch, size_t column, size_t row) const
     {
-        switch (_print_style)
+        auto& type = _columns[column];
+        const char* data;
+        if (!valid(batch, column, row))
+            return T();
+
+        if (type.type == 6)
         {
-        case PrintStyle::BASIC:
-        case PrintStyle::FULL:
-            stream << "+";
-            for (unsigned int i = 0; i < _num_columns; i++)
-                stream << std::string(_column_sizes[i] + (2 * _cell_padding), '-') << "+";
+            if (!buffer(batch, column, 1, data, (_batches[batch].rows + 7) / 8))
+                return T();
+            return static_cast<T>((data[row / 8] >> (row % 8)) & 1);
+        }
 
-            stream << "\n";
-            break;
-        case PrintStyle::SIMPLE:
-            stream << " ";
-            for (unsigned int i = 0; i < _num_columns; i++)
-                stream << std::string(_column_sizes[i] + (2 * _cell_padding), '-') << " ";
+        auto width = type.bit_width / 8;
+        if ((type.type != 2 && type.type != 3) || !buffer(batch, column, 1, data, width * _batches[batch].rows))
+            return T();
 
-            stream << "\n";
-            break;
-        default:
-            break;
+        data += width * row;
+        if (type.type == 3)
+            return width == 4 ? static_cast<T>(load<float>(data)) : static_cast<T>(load<double>(data));
+
+        switch (width)
+        {
+        case 1: return type.is_signed ? static_cast<T>(load<int8_t>(data)) : static_cast<T>(load<uint8_t>(data));
+        case 2: return type.is_signed ? static_cast<T>(load<int16_t>(data)) : static_cast<T>(load<uint16_t>(data));
+        case 4: return type.is_signed ? static_cast<T>(load<int32_t>(data)) : static_cast<T>(load<uint32_t>(data));
+        default: return type.is_signed ? static_cast<T>(load<int64_t>(data)) : static_cast<T>(load<uint64_t>(data));
         }
     }
+
     /**
-     * Finds the size each column should be and set it in _column_sizes
+     * A value of a Utf8 column ("" if it's null)
      */
-    void size_columns()
+    std::string text(size_t batch, size_t column, size_t row) const
     {
-        _column_sizes.resize(_num_columns);
+        const char *offsets, *data;
+        auto rows = _batches[batch].rows;
+        if (_columns[column].type != 5 || !valid(batch, column, row) ||
+            !buffer(batch, column, 1, offsets, 4 * (rows + 1)))
+            return std::string();
 
-        // Temporary for querying each row
-        std::vector<unsigned int> column_sizes(_num_columns);
+        auto start = load<int32_t>(offsets + 4 * row), end = load<int32_t>(offsets + 4 * (row + 1));
+        if (start < 0 || end < start || !buffer(batch, column, 2, data, static_cast<size_t>(end)))
+            return std::string();
 
-        // Start with the size of the headers
-        for (unsigned int i = 0; i < _num_columns; i++)
-            _column_sizes[i] = _headers[i].size();
+        return std::string(data + start, static_cast<size_t>(end - start));
+    }
 
-        // Grab the size of each entry of each row and see if it's bigger
-        for (auto& row : _data)
+    /**
+     * Add every row to a table
+     *
+     * @return false if the columns don't fit the table's: numbers (and bools)
+     *         must go in numbers and text in std::string
+     */
+    template <class... Ts>
+    bool readInto(VarTable<Ts...>& table) const
+    {
+        if (_columns.size() != sizeof...(Ts) || !fits<Ts...>(0))
+            return false;
+
+        for (size_t batch = 0; batch < _batches.size(); batch++)
         {
-            size_each(row, column_sizes);
+            for (size_t row = 0; row < _batches[batch].rows; row++)
+                add_row(table, batch, row, typename VarTableMakeIndexList<sizeof...(Ts)>::type());
+        }
 
-            for (unsigned int i = 0; i < _num_columns; i++)
-                _column_sizes[i] = std::max(_column_sizes[i], column_sizes[i]);
+        return true;
+    }
+
+protected:
+    /**
+     * A column's length and null count in a record batch
+     */
+    struct Node
+    {
+        int64_t length;
+        int64_t null_count;
+    };
+
+    /**
+     * Where a record batch is
+     */
+    struct Batch
+    {
+        /// The number of rows
+        size_t rows;
+
+        /// Where its body starts in the file, and its size
+        size_t body;
+        size_t body_length;
+
+        /// A node for each column
+        std::vector<Node> nodes;
+
+        /// Where each column's buffers start in _buffers
+        std::vector<size_t> first_buffer;
+
+        /// Each buffer's offset in the body and its size
+        std::vector<std::pair<int64_t, int64_t>> buffers;
+    };
+
+    template <class T>
+    static T load(const char* data)
+    {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    /**
+     * Find one of a column's buffers, checking that it's in the file and at least size bytes
+     */
+    bool buffer(size_t batch, size_t column, size_t index, const char*& data, size_t size) const
+    {
+        auto& b = _batches[batch];
+        auto& buffer = b.buffers[b.first_buffer[column] + index];
+        if (buffer.first < 0 || buffer.second < 0 || static_cast<size_t>(buffer.second) < size ||
+            static_cast<uint64_t>(buffer.first) + static_cast<uint64_t>(buffer.second) > b.body_length)
+            return false;
+
+        data = _map + b.body + buffer.first;
+        return true;
+    }
+
+    /**
+     * Read each message: the schema, then the record batches
+     */
+    bool read_messages()
+    {
+        size_t position = 0;
+
+        // The file format is the stream format between a magic number and a footer
+        if (_size >= 8 && std::memcmp(_map, "ARROW1", 6) == 0)
+            position = 8;
+
+        bool have_schema = false;
+        while (position + 8 <= _size)
+        {
+            uint32_t length;
+            VarTableFlatTable::read(_map, _size, position, length);
+            position += 4;
+
+            // Before version 0.15 there was no continuation marker
+            if (length == 0xFFFFFFFF)
+            {
+                VarTableFlatTable::read(_map, _size, position, length);
+                position += 4;
+            }
+
+            if (length == 0) // The end of the stream
+                break;
+
+            if (length > _size - position)
+                return false;
+
+            VarTableFlatTable message, header;
+            if (!VarTableFlatTable::root(_map + position, length, message) || !message.table(2, header))
+                return false;
+
+            auto body_length = message.scalar<int64_t>(3, 0);
+            position += length;
+            if (body_length < 0 || static_cast<uint64_t>(body_length) > _size - position)
+                return false;
+
+            auto header_type = message.scalar<unsigned char>(1, 0);
+            if (header_type == 1 && !have_schema)
+            {
+                if (!read_schema(header))
+                    return false;
+                have_schema = true;
+            }
+            else if (header_type == 3 && have_schema)
+            {
+                if (!read_batch(header, position, static_cast<size_t>(body_length)))
+                    return false;
+            }
+            else if (header_type == 2) // Dictionaries aren't supported
+                return false;
+
+            position += static_cast<size_t>(body_length);
         }
+
+        return have_schema;
     }
 
-    /// The column headers
-    std::vector<std::string> _headers;
+    bool read_schema(const VarTableFlatTable& schema)
+    {
+        size_t fields;
+        uint32_t count;
+        if (!schema.vector(1, fields, count))
+            return false;
 
-    /// Number of columns in the table
-    unsigned int _num_columns;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            VarTableFlatTable field, type;
+            if (!schema.follow(fields + 4 * i, field) || !field.table(3, type))
+                return false;
 
-    /// Size of columns that we can't get the size of
-    unsigned int _static_column_size;
+            Column column = { std::string(), field.scalar<unsigned char>(2, 0), 0, false };
+            field.string(0, column.name);
 
-    /// Size of the cell padding
-    unsigned int _cell_padding;
+            // Nested types and dictionaries aren't supported
+            size_t elements;
+            uint32_t children = 0;
+            VarTableFlatTable dictionary;
+            if ((field.vector(5, elements, children) && children) || field.table(4, dictionary))
+                return false;
 
-    /// The actual data
-    std::vector<DataTuple> _data;
+            if (column.type == 2)
+            {
+                column.bit_width = type.scalar<uint32_t>(0, 0);
+                column.is_signed = type.scalar<unsigned char>(1, 0) != 0;
+                if (column.bit_width != 8 && column.bit_width != 16 && column.bit_width != 32 && column.bit_width != 64)
+                    return false;
+            }
+            else if (column.type == 3)
+            {
+                auto precision = type.scalar<int16_t>(0, 0);
+                if (precision != 1 && precision != 2) // Half floats aren't supported
+                    return false;
+                column.bit_width = precision == 1 ? 32 : 64;
+                column.is_signed = true;
+            }
+            else if (column.type != 5 && column.type != 6)
+                return false;
 
-    /// Holds the printable width of each column
-    std::vector<unsigned int> _column_sizes;
+            _columns.push_back(column);
+        }
 
-    /// Column Format
-    std::vector<VarTableColumnFormat> _column_format;
+        return true;
+    }
 
-    /// Print Style
-    PrintStyle _print_style;
+    bool read_batch(const VarTableFlatTable& record_batch, size_t body, size_t body_length)
+    {
+        Batch batch;
+        batch.rows = static_cast<size_t>(record_batch.scalar<int64_t>(0, 0));
+        batch.body = body;
+        batch.body_length = body_length;
 
-    /// Alignment Style
-    std::vector<AlignmentStyle> _alignment_style;
+        // Compressed bodies aren't supported
+        VarTableFlatTable compression;
+        if (record_batch.table(3, compression))
+            return false;
 
-    /// Precision For each column
-    std::vector<int> _precision;
+        size_t nodes, buffers;
+        uint32_t num_nodes, num_buffers;
+        if (!record_batch.vector(1, nodes, num_nodes) || !record_batch.vector(2, buffers, num_buffers) ||
+            num_nodes != _columns.size() ||
+            16 * static_cast<uint64_t>(num_nodes) > record_batch.size() - nodes ||
+            16 * static_cast<uint64_t>(num_buffers) > record_batch.size() - buffers)
+            return false;
+
+        auto data = record_batch.data();
+        for (uint32_t i = 0; i < num_nodes; i++)
+        {
+            Node node = { load<int64_t>(data + nodes + 16 * i), load<int64_t>(data + nodes + 16 * i + 8) };
+            if (node.length != static_cast<int64_t>(batch.rows))
+                return false;
+
+            batch.nodes.push_back(node);
+            batch.first_buffer.push_back(batch.buffers.size());
+            batch.buffers.resize(batch.buffers.size() + (_columns[i].type == 5 ? 3 : 2));
+        }
+
+        if (batch.buffers.size() != num_buffers)
+            return false;
+
+        for (uint32_t i = 0; i < num_buffers; i++)
+        {
+            batch.buffers[i].first = load<int64_t>(data + buffers + 16 * i);
+            batch.buffers[i].second = load<int64_t>(data + buffers + 16 * i + 8);
+        }
+
+        _batches.push_back(std::move(batch));
+        return true;
+    }
+
+    /**
+     * Whether each column can be read into a column of type T
+     */
+    template <class... Ts>
+    typename std::enable_if<sizeof...(Ts) == 0, bool>::type fits(size_t) const
+    {
+        return true;
+    }
+
+    template <class T, class... Ts>
+    bool fits(size_t column) const
+    {
+        auto type = _columns[column].type;
+        bool column_fits = std::is_arithmetic<T>::value ? type != 5 : std::is_same<T, std::string>::value && type == 5;
+
+        return column_fits && fits<Ts...>(column + 1);
+    }
+
+    /**
+     * Read one column's value as T
+     */
+    template <class T>
+    typename std::enable_if<std::is_arithmetic<T>::value, T>::type value(size_t batch, size_t column, size_t row) const
+    {
+        return number<T>(batch, column, row);
+    }
+
+    template <class T>
+    typename std::enable_if<std::is_same<T, std::string>::value, T>::type value(size_t batch, size_t column, size_t row) const
+    {
+        return text(batch, column, row);
+    }
+
+    /// Other types can't be read (fits() is false for them)
+    template <class T>
+    typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_same<T, std::string>::value, T>::type
+        value(size_t, size_t, size_t) const
+    {
+        return T();
+    }
+
+    template <class... Ts, size_t... I>
+    void add_row(VarTable<Ts...>& table, size_t batch, size_t row, VarTableIndexList<I...>) const
+    {
+        table.addRow(value<Ts>(batch, I, row)...);
+    }
+
+    /// The mapped file
+    const char* _map;
+    size_t _size;
+
+    /// The columns
+    std::vector<Column> _columns;
+
+    /// The record batches
+    std::vector<Batch> _batches;
 };
+#endif
 
 #endif  // VAR_TABLE_H_
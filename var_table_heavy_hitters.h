@@ -0,0 +1,339 @@
+#ifndef VAR_TABLE_HEAVY_HITTERS_H_
+#define VAR_TABLE_HEAVY_HITTERS_H_
+
+#include "var_table.h"
+
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The most frequent keys of a stream, counted approximately in fixed memory
+ *
+ * Uses the Space-Saving algorithm with a fixed number of counters: a key
+ * that isn't counted yet takes over the counter with the smallest count.
+ * The counters are kept in a stream summary (a list of buckets of counters
+ * with the same count, in order of count) found through a hash index, so
+ * adding a key once takes constant time.  A weighted add() moves the key's
+ * counter past every bucket it overtakes, so it takes time in proportion to
+ * how many distinct counts it passes.
+ *
+ * Every key whose count is more than total() / capacity() is guaranteed to
+ * be counted.  A counted key's count may be too high, but by no more than
+ * its error, so count - error is a lower bound on how often it was seen.
+ *
+ * VarTableHeavyHitters<> endpoints(1000, "Endpoint");
+ * for (auto& event : events)
+ *     endpoints.add(event.path);
+ * endpoints.table(20).print(std::cout);
+ */
+template <class Key = std::string>
+class VarTableHeavyHitters
+{
+public:
+    /// The table the counts are rendered as: key, count, error and guaranteed count
+    typedef VarTable<Key, uint64_t, uint64_t, uint64_t> Table;
+
+    /**
+     * @param capacity How many keys to count
+     * @param key_header The header of the key column
+     */
+    VarTableHeavyHitters(size_t capacity, std::string key_header = "Key")
+        : _capacity(capacity),
+        _key_header(std::move(key_header)),
+        _total(0),
+        _first_bucket(none()),
+        _last_bucket(none()),
+        _free_bucket(none())
+    {
+        assert(capacity > 0);
+
+        _counters.reserve(capacity);
+        _buckets.reserve(capacity);
+        _index.reserve(capacity);
+    }
+
+    /**
+     * Count a key
+     *
+     * @param weight How many times it was seen (0 changes nothing)
+     */
+    void add(const Key& key, uint64_t weight = 1)
+    {
+        if (weight == 0)
+            return;
+
+        _total += weight;
+
+        auto found = _index.find(key);
+        if (found != _index.end())
+        {
+            increment(found->second, weight);
+            return;
+        }
+
+        if (_counters.size() < _capacity)
+        {
+            // A new counter starts at 0, before every bucket
+            size_t c = _counters.size();
+            _counters.emplace_back(key);
+            _index.emplace(key, c);
+            place(c, weight, none(), _first_bucket);
+            return;
+        }
+
+        // Take over a counter with the smallest count: its count is the most the new key could have been missed by
+        size_t c = _buckets[_first_bucket].first_counter;
+        auto& counter = _counters[c];
+        _index.erase(counter.key);
+
+        counter.key = key;
+        counter.error = _buckets[_first_bucket].count;
+        _index.emplace(key, c);
+
+        increment(c, weight);
+    }
+
+    /**
+     * How many times a key was seen (an overestimate by up to its error), or 0 if it isn't counted
+     */
+    uint64_t count(const Key& key) const
+    {
+        auto found = _index.find(key);
+
+        return found != _index.end() ? _buckets[_counters[found->second].bucket].count : 0;
+    }
+
+    /**
+     * The total weight of everything added
+     */
+    uint64_t total() const { return _total; }
+
+    /**
+     * How many keys can be counted
+     */
+    size_t capacity() const { return _capacity; }
+
+    /**
+     * How many keys are counted
+     */
+    size_t size() const { return _counters.size(); }
+
+    /**
+     * The most any count can be too high by: keys seen more often than this are always counted
+     */
+    uint64_t errorBound() const { return _counters.size() < _capacity ? 0 : _buckets[_first_bucket].count; }
+
+    /**
+     * Forget everything
+     */
+    void clear()
+    {
+        _total = 0;
+        _counters.clear();
+        _buckets.clear();
+        _index.clear();
+        _first_bucket = _last_bucket = _free_bucket = none();
+    }
+
+    /**
+     * The counted keys, most frequent first, as a table
+     *
+     * @param top How many keys to include (0 for all of them)
+     */
+    Table table(size_t top = 0) const
+    {
+        Table table({ _key_header, "Count", "Error", "Guaranteed" });
+
+        if (top == 0 || top > _counters.size())
+            top = _counters.size();
+
+        for (size_t b = _last_bucket; b != none() && top > 0; b = _buckets[b].prev)
+        {
+            for (size_t c = _buckets[b].first_counter; c != none() && top > 0; c = _counters[c].next, top--)
+            {
+                auto& counter = _counters[c];
+                table.addRow(counter.key, _buckets[b].count, counter.error, _buckets[b].count - counter.error);
+            }
+        }
+
+        return table;
+    }
+
+protected:
+    /**
+     * A counted key: its count is its bucket's
+     */
+    struct Counter
+    {
+        Counter(const Key& key) : key(key), error(0), bucket(none()), prev(none()), next(none()) {}
+
+        Key key;
+        uint64_t error;
+
+        size_t bucket;
+
+        /// The other counters in the bucket
+        size_t prev;
+        size_t next;
+    };
+
+    /**
+     * The counters with the same count
+     */
+    struct Bucket
+    {
+        uint64_t count;
+        size_t first_counter;
+
+        /// The buckets with the next smaller and larger counts
+        size_t prev;
+        size_t next;
+    };
+
+    /**
+     * The index of nothing
+     */
+    static size_t none() { return std::numeric_limits<size_t>::max(); }
+
+    /**
+     * Move a counter up by weight
+     */
+    void increment(size_t c, uint64_t weight)
+    {
+        size_t b = _counters[c].bucket;
+        uint64_t count = _buckets[b].count + weight;
+
+        detach(c);
+
+        // Its bucket can go once it's empty, but the search starts from it
+        size_t prev = b;
+        size_t next = _buckets[b].next;
+        if (_buckets[b].first_counter == none())
+        {
+            prev = _buckets[b].prev;
+            unlink_bucket(b);
+        }
+
+        place(c, count, prev, next);
+    }
+
+    /**
+     * Put a counter in the bucket for count, searching forward from between prev and next
+     */
+    void place(size_t c, uint64_t count, size_t prev, size_t next)
+    {
+        // Usually the next bucket up, or a new one just before it
+        while (next != none() && _buckets[next].count < count)
+        {
+            prev = next;
+            next = _buckets[next].next;
+        }
+
+        size_t b = next;
+        if (b == none() || _buckets[b].count != count)
+            b = insert_bucket(count, prev, next);
+
+        auto& counter = _counters[c];
+        counter.bucket = b;
+        counter.prev = none();
+        counter.next = _buckets[b].first_counter;
+        if (counter.next != none())
+            _counters[counter.next].prev = c;
+        _buckets[b].first_counter = c;
+    }
+
+    /**
+     * Take a counter out of its bucket
+     */
+    void detach(size_t c)
+    {
+        auto& counter = _counters[c];
+
+        if (counter.prev != none())
+            _counters[counter.prev].next = counter.next;
+        else
+            _buckets[counter.bucket].first_counter = counter.next;
+
+        if (counter.next != none())
+            _counters[counter.next].prev = counter.prev;
+    }
+
+    /**
+     * Make an empty bucket between prev and next
+     */
+    size_t insert_bucket(uint64_t count, size_t prev, size_t next)
+    {
+        size_t b = _free_bucket;
+        if (b != none())
+            _free_bucket = _buckets[b].next;
+        else
+        {
+            b = _buckets.size();
+            _buckets.emplace_back();
+        }
+
+        _buckets[b] = Bucket{ count, none(), prev, next };
+
+        if (prev != none())
+            _buckets[prev].next = b;
+        else
+            _first_bucket = b;
+
+        if (next != none())
+            _buckets[next].prev = b;
+        else
+            _last_bucket = b;
+
+        return b;
+    }
+
+    /**
+     * Take an empty bucket out of the list and keep it for reuse
+     */
+    void unlink_bucket(size_t b)
+    {
+        auto& bucket = _buckets[b];
+
+        if (bucket.prev != none())
+            _buckets[bucket.prev].next = bucket.next;
+        else
+            _first_bucket = bucket.next;
+
+        if (bucket.next != none())
+            _buckets[bucket.next].prev = bucket.prev;
+        else
+            _last_bucket = bucket.prev;
+
+        bucket.next = _free_bucket;
+        _free_bucket = b;
+    }
+
+    /// How many keys can be counted
+    size_t _capacity;
+
+    /// The header of the key column
+    std::string _key_header;
+
+    /// The total weight added
+    uint64_t _total;
+
+    /// The counters, never more than _capacity
+    std::vector<Counter> _counters;
+
+    /// The buckets, with the unused ones in a free list
+    std::vector<Bucket> _buckets;
+
+    /// The buckets with the smallest and largest counts, and the first unused one
+    size_t _first_bucket;
+    size_t _last_bucket;
+    size_t _free_bucket;
+
+    /// Finds the counter of a key
+    std::unordered_map<Key, size_t, VarTableHash, VarTableEqual> _index;
+};
+
+#endif  // VAR_TABLE_HEAVY_HITTERS_H_
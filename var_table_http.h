@@ -0,0 +1,557 @@
+#ifndef VAR_TABLE_HTTP_H_
+#define VAR_TABLE_HTTP_H_
+
+#include "var_table.h"
+
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * A tiny HTTP server for looking at live tables (Linux only)
+ *
+ * Single threaded and epoll based: call poll() from your own event loop, or
+ * run() to serve until stop() is called.  Each registered table is served as
+ * text, HTML or JSON:
+ *
+ *   /                                  The names of the tables
+ *   /tables/<name>                     The table as text
+ *   /tables/<name>?format=html         ... as an HTML page
+ *   /tables/<name>?format=json         ... as JSON
+ *   /tables/<name>?offset=100&limit=50 Just rows 100 to 149
+ *
+ * Rendered pages are cached until the table changes, and a page of rows only
+ * costs as much as the page (its columns are sized to fit just those rows).
+ *
+ * The tables are referenced, not copied: they must outlive the server, and
+ * must only be changed from the thread that calls poll().
+ *
+ * VarTableHttpServer server;
+ * server.addTable("hosts", hosts);
+ * server.listen(8080);
+ * server.run(); // curl http://127.0.0.1:8080/tables/hosts
+ */
+class VarTableHttpServer
+{
+public:
+    VarTableHttpServer() : _listen_fd(-1), _epoll_fd(-1), _running(false), _accept_paused(false) {}
+
+    ~VarTableHttpServer() { close_all(); }
+
+    VarTableHttpServer(const VarTableHttpServer&) = delete;
+    VarTableHttpServer& operator=(const VarTableHttpServer&) = delete;
+
+    /**
+     * Serve a table
+     *
+     * @param name The name the table is served under: /tables/<name>
+     */
+    template <class... Ts>
+    void addTable(const std::string& name, VarTable<Ts...>& table)
+    {
+        _tables[name].reset(new Member<VarTable<Ts...>>(table));
+    }
+
+    /**
+     * Start listening for connections
+     *
+     * Listening again drops the old socket and its connections.
+     *
+     * @param port The port to listen on: 0 picks a free one (see port())
+     * @param address The address to listen on
+     * @return False (with errno set) if the socket couldn't be set up
+     */
+    bool listen(uint16_t port, const char* address = "127.0.0.1")
+    {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        close_all();
+
+        _listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (_listen_fd < 0)
+            return false;
+
+        int yes = 1;
+        setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        if (::bind(_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+            ::listen(_listen_fd, SOMAXCONN) == 0 && (_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0 &&
+            watch(_listen_fd, EPOLLIN, EPOLL_CTL_ADD))
+            return true;
+
+        // Don't leave half a listener behind (or lose why it failed)
+        int error = errno;
+        close_all();
+        errno = error;
+
+        return false;
+    }
+
+    /**
+     * The port being listened on
+     */
+    uint16_t port() const
+    {
+        sockaddr_in addr;
+        socklen_t size = sizeof(addr);
+        if (getsockname(_listen_fd, reinterpret_cast<sockaddr*>(&addr), &size) != 0)
+            return 0;
+
+        return ntohs(addr.sin_port);
+    }
+
+    /**
+     * Handle whatever network events are ready
+     *
+     * @param timeout_ms How long to wait for something to happen (-1 for forever)
+     */
+    void poll(int timeout_ms = 0)
+    {
+        epoll_event events[64];
+        int num_events = epoll_wait(_epoll_fd, events, 64, timeout_ms);
+
+        for (int i = 0; i < num_events; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == _listen_fd)
+            {
+                accept_all();
+                continue;
+            }
+
+            auto connection = _connections.find(fd);
+            if (connection == _connections.end())
+                continue;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                close_connection(fd);
+            else if (events[i].events & EPOLLIN)
+                read_request(fd, connection->second);
+            else if (events[i].events & EPOLLOUT)
+                write_response(fd, connection->second);
+        }
+    }
+
+    /**
+     * Serve until stop() is called
+     */
+    void run()
+    {
+        _running = true;
+        while (_running)
+            poll(100);
+    }
+
+    /**
+     * Make run() return
+     */
+    void stop() { _running = false; }
+
+protected:
+    /// Requests bigger than this are refused
+    static const size_t _max_request = 8192;
+
+    /// Rendered pages kept for each table
+    static const size_t _max_cached_pages = 16;
+
+    /**
+     * The interface to a table that doesn't depend on its column types
+     */
+    class Table
+    {
+    public:
+        virtual ~Table() {}
+
+        /// Whether output rendered at the same version() can be reused
+        virtual bool cacheable() const = 0;
+        virtual uint64_t version() const = 0;
+        virtual void render(std::ostream& stream, const std::string& format, size_t first, size_t count) = 0;
+
+        /// Rendered pages, by format/offset/limit, with the version they were rendered at
+        std::map<std::string, std::pair<uint64_t, std::shared_ptr<const std::string>>> cache;
+    };
+
+    /**
+     * Forwards the interface to a VarTable
+     */
+    template <class TableType>
+    class Member : public Table
+    {
+    public:
+        Member(TableType& table) : _table(table) {}
+
+        bool cacheable() const override { return !_table.hasBoundRows(); }
+        uint64_t version() const override { return _table.version(); }
+
+        void render(std::ostream& stream, const std::string& format, size_t first, size_t count) override
+        {
+            if (format == "json")
+                _table.printJSON(stream, first, count);
+            else if (format == "html")
+            {
+                stream << "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"></head><body>\n";
+                _table.printHTML(stream, first, count);
+                stream << "</body></html>\n";
+            }
+            else
+                _table.printRange(stream, first, count);
+        }
+
+    protected:
+        TableType& _table;
+    };
+
+    /**
+     * A client connection
+     */
+    struct Connection
+    {
+        Connection() : sent(0) {}
+
+        /// What has been read of the request so far
+        std::string request;
+
+        /// The status line and headers of the response
+        std::string head;
+
+        /// The body of the response (shared with the cache)
+        std::shared_ptr<const std::string> body;
+
+        /// How many bytes of head + body have been written
+        size_t sent;
+    };
+
+    /**
+     * Register (or change) the events we want for a descriptor
+     */
+    bool watch(int fd, uint32_t events, int op)
+    {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.fd = fd;
+
+        return epoll_ctl(_epoll_fd, op, fd, &event) == 0;
+    }
+
+    /**
+     * Accept every waiting connection
+     *
+     * Out of descriptors, the listening socket would stay readable and poll()
+     * would spin: it's left alone until a connection closes instead.
+     */
+    void accept_all()
+    {
+        for (;;)
+        {
+            int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if ((errno == EMFILE || errno == ENFILE) && !_connections.empty() &&
+                    watch(_listen_fd, 0, EPOLL_CTL_MOD))
+                    _accept_paused = true;
+                return;
+            }
+
+            _connections[fd];
+            if (!watch(fd, EPOLLIN, EPOLL_CTL_ADD))
+                close_connection(fd);
+        }
+    }
+
+    void close_connection(int fd)
+    {
+        _connections.erase(fd);
+        ::close(fd);
+
+        if (_accept_paused && watch(_listen_fd, EPOLLIN, EPOLL_CTL_MOD))
+            _accept_paused = false;
+    }
+
+    /**
+     * Close the connections, the listening socket and the epoll instance
+     */
+    void close_all()
+    {
+        for (auto& connection : _connections)
+            ::close(connection.first);
+        _connections.clear();
+
+        if (_listen_fd >= 0)
+            ::close(_listen_fd);
+
+        if (_epoll_fd >= 0)
+            ::close(_epoll_fd);
+
+        _listen_fd = -1;
+        _epoll_fd = -1;
+        _accept_paused = false;
+    }
+
+    /**
+     * Read what's there of a request: once it's all there, start the response
+     */
+    void read_request(int fd, Connection& connection)
+    {
+        char buffer[4096];
+        bool complete = false;
+        bool too_large = false;
+
+        // Stop as soon as the request is all there, or bigger than we'll take
+        while (!complete && !too_large)
+        {
+            auto result = ::read(fd, buffer, sizeof(buffer));
+
+            if (result > 0)
+            {
+                // The end of the headers may straddle the last read
+                size_t from = connection.request.size() < 3 ? 0 : connection.request.size() - 3;
+                connection.request.append(buffer, result);
+
+                complete = connection.request.find("\r\n\r\n", from) != std::string::npos;
+                too_large = connection.request.size() > _max_request;
+                continue;
+            }
+
+            if (result < 0 && errno == EINTR)
+                continue;
+
+            if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+
+            // Closed (or failed) before sending a whole request
+            return close_connection(fd);
+        }
+
+        if (too_large)
+            respond(connection, "413 Payload Too Large", "text/plain", text_body("Request too large\n"));
+        else
+            handle(connection);
+
+        if (watch(fd, EPOLLOUT, EPOLL_CTL_MOD))
+            write_response(fd, connection);
+        else
+            close_connection(fd);
+    }
+
+    /**
+     * Write what the client will take of the response, closing the connection when it's all gone
+     */
+    void write_response(int fd, Connection& connection)
+    {
+        for (;;)
+        {
+            const std::string& part =
+                connection.sent < connection.head.size() ? connection.head : *connection.body;
+            size_t offset = connection.sent < connection.head.size() ?
+                connection.sent : connection.sent - connection.head.size();
+
+            if (offset == part.size())
+                return close_connection(fd);
+
+            auto result = ::send(fd, part.data() + offset, part.size() - offset, MSG_NOSIGNAL);
+
+            if (result > 0)
+                connection.sent += result;
+            else if (result < 0 && errno == EINTR)
+                continue;
+            else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            else
+                return close_connection(fd);
+        }
+    }
+
+    /**
+     * Work out the response to a request
+     */
+    void handle(Connection& connection)
+    {
+        // GET <target> HTTP/1.1
+        const std::string& request = connection.request;
+        auto method_end = request.find(' ');
+        auto target_end = request.find(' ', method_end + 1);
+
+        if (method_end == std::string::npos || target_end == std::string::npos)
+            return respond(connection, "400 Bad Request", "text/plain", text_body("Bad request\n"));
+
+        if (request.compare(0, method_end, "GET") != 0)
+            return respond(connection, "405 Method Not Allowed", "text/plain", text_body("Only GET is supported\n"));
+
+        std::string target = request.substr(method_end + 1, target_end - method_end - 1);
+        std::string path = target.substr(0, target.find('?'));
+        std::map<std::string, std::string> query;
+
+        if (path.size() != target.size())
+            parse_query(target.substr(path.size() + 1), query);
+
+        if (path == "/")
+        {
+            std::string names;
+            for (auto& table : _tables)
+                names += table.first + "\n";
+
+            return respond(connection, "200 OK", "text/plain", text_body(names));
+        }
+
+        const std::string prefix = "/tables/";
+        auto table = path.compare(0, prefix.size(), prefix) == 0 ?
+            _tables.find(decode(path.substr(prefix.size()))) : _tables.end();
+
+        if (table == _tables.end())
+            return respond(connection, "404 Not Found", "text/plain", text_body("No such table\n"));
+
+        std::string format = query.count("format") ? query["format"] : "text";
+        size_t first = query.count("offset") ? std::strtoull(query["offset"].c_str(), nullptr, 10) : 0;
+        size_t count = query.count("limit") ?
+            std::strtoull(query["limit"].c_str(), nullptr, 10) : static_cast<size_t>(-1);
+
+        const char* content_type = format == "json" ? "application/json" :
+            format == "html" ? "text/html; charset=utf-8" : "text/plain; charset=utf-8";
+
+        respond(connection, "200 OK", content_type, render(*table->second, format, first, count));
+    }
+
+    /**
+     * Render a page of a table, or reuse the last rendering if the table hasn't changed
+     */
+    std::shared_ptr<const std::string> render(Table& table, const std::string& format, size_t first, size_t count)
+    {
+        std::ostringstream key;
+        key << format << "/" << first << "/" << count;
+
+        if (table.cacheable())
+        {
+            auto cached = table.cache.find(key.str());
+            if (cached != table.cache.end() && cached->second.first == table.version())
+                return cached->second.second;
+        }
+
+        std::shared_ptr<std::string> body(new std::string());
+        {
+            VarTableStringBuf buf(*body);
+            std::ostream stream(&buf);
+            table.render(stream, format, first, count);
+        }
+
+        if (table.cacheable())
+        {
+            if (table.cache.size() >= _max_cached_pages)
+                table.cache.clear();
+
+            table.cache[key.str()] = std::make_pair(table.version(), body);
+        }
+
+        return body;
+    }
+
+    /**
+     * Set the response to send
+     */
+    void respond(Connection& connection,
+        const char* status,
+        const char* content_type,
+        std::shared_ptr<const std::string> body)
+    {
+        std::ostringstream head;
+        head << "HTTP/1.1 " << status << "\r\n"
+            << "Content-Type: " << content_type << "\r\n"
+            << "Content-Length: " << body->size() << "\r\n"
+            << "Connection: close\r\n\r\n";
+
+        connection.head = head.str();
+        connection.body = std::move(body);
+        connection.sent = 0;
+    }
+
+    static std::shared_ptr<const std::string> text_body(const std::string& text)
+    {
+        return std::make_shared<const std::string>(text);
+    }
+
+    /**
+     * Split name=value&name=value into a map
+     */
+    static void parse_query(const std::string& query, std::map<std::string, std::string>& values)
+    {
+        size_t start = 0;
+        while (start <= query.size())
+        {
+            auto end = query.find('&', start);
+            if (end == std::string::npos)
+                end = query.size();
+
+            auto pair = query.substr(start, end - start);
+            auto equals = pair.find('=');
+            if (equals != std::string::npos)
+                values[decode(pair.substr(0, equals))] = decode(pair.substr(equals + 1));
+
+            start = end + 1;
+        }
+    }
+
+    /**
+     * Undo URL %-encoding
+     */
+    static std::string decode(const std::string& text)
+    {
+        std::string decoded;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            if (text[i] == '%' && i + 2 < text.size() && std::isxdigit(static_cast<unsigned char>(text[i + 1])) &&
+                std::isxdigit(static_cast<unsigned char>(text[i + 2])))
+            {
+                decoded.push_back(static_cast<char>(std::strtol(text.substr(i + 1, 2).c_str(), nullptr, 16)));
+                i += 2;
+            }
+            else if (text[i] == '+')
+                decoded.push_back(' ');
+            else
+                decoded.push_back(text[i]);
+        }
+
+        return decoded;
+    }
+
+    /// The socket connections are accepted on
+    int _listen_fd;
+
+    /// The epoll instance
+    int _epoll_fd;
+
+    /// Whether run() should keep going
+    bool _running;
+
+    /// Whether accepting is put off until a connection closes (out of descriptors)
+    bool _accept_paused;
+
+    /// The tables being served, by name
+    std::map<std::string, std::unique_ptr<Table>> _tables;
+
+    /// The open connections, by descriptor
+    std::map<int, Connection> _connections;
+};
+
+#endif  // VAR_TABLE_HTTP_H_